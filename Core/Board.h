@@ -14,7 +14,12 @@
 // CAN config
 #define CAN_PINS			(PB8 | PB9)
 #define CAN_AF				GPIO_AF4_CAN
-#define CAN_USE_IRQS
+// The CAN IRQ is handled by CANBus.c
+
+// TIM config
+#define TIM1_ENABLE
+#define TIM2_ENABLE
+#define TIM_USE_IRQS
 
 // USB config
 #define USB_ENABLE
@@ -38,6 +43,9 @@
 #define MAX3301_FAULT_PIN	CAN_SNS_PIN
 #define MAX3301_CANTX_PIN	PB9
 #define MAX3301_CANRX_PIN	PB8
+// Channels 0 and 1 are taken by Timed.c and Replay.c
+#define MAX3301_TIM			TIM_2
+#define MAX3301_TIM_CHANNEL	2
 
 
 #endif /* BOARD_H */
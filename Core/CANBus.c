@@ -0,0 +1,514 @@
+
+#include "CANBus.h"
+#include "Packed.h"
+#include "Queue.h"
+#include "Core.h"
+#include "TIM.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define CANBUS_RQCP		(CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2)
+#define CANBUS_TIR_ID	(CAN_TI0R_STID | CAN_TI0R_EXID | CAN_TI0R_IDE)
+
+// In bytes, and must be a power of two. Frames are packed, so this holds
+// 146 standard frames of 8 bytes, and at least 120 of any shape.
+#define CANBUS_RX_SIZE	2048
+// Each frame carries its time, a coarse tick and its filter index
+#define CANBUS_RX_EXTRA	4
+// The tick is kept in one byte of 16ms steps. It only has to place the bit
+// time within its wrap, so a frame may wait up to 4s in the ring.
+#define CANBUS_TICK_SHIFT	4
+
+// The lowest standard ID bit decides which FIFO a frame is spread to
+#define CANBUS_SPREAD_BIT	(1 << 21)
+
+// A bank holds up to four 16 bit IDs
+#define CANBUS_FILTER_MAX	(CANBUS_FILTER_BANKS * 4)
+
+// Changes of bus state waiting for the main loop. Must be a power of two.
+#define CANBUS_STATUS_SIZE	8
+
+// Entering initialisation waits for the frame on the bus to end.
+// This covers the longest stuffed frame at 10kbit/s.
+#define CANBUS_INIT_TIMEOUT_US	20000
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void CANBus_ReadMailbox(uint32_t fifo, CANBus_Frame_t * frame);
+static void CANBus_DrainFifos(void);
+static void CANBus_StoreFrame(uint32_t fifo);
+static uint32_t CANBus_EncodeId(uint32_t id, bool ext);
+static void CANBus_WriteMailbox(uint32_t tir, uint32_t len, uint32_t low, uint32_t high);
+static uint32_t CANBus_FilterCount(uint32_t bank);
+static void CANBus_MapFilters(void);
+static void CANBus_CheckState(void);
+static bool CANBus_SetMode(uint32_t set, uint32_t clear);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	void (*on_transmit)(void);
+	void (*on_error)(CAN_Error_t error);
+	volatile bool kick;
+	bool auto_recovery;
+	Packed_t rx;
+	CANBus_Stats_t stats;
+	// Written by CANBus_CheckState, which is never preempted by itself.
+	CANBus_Status_t status;
+	Queue_t changes;
+} gCANBus = {
+	.auto_recovery = true,
+};
+
+static uint8_t gCANBusRxBuffer[CANBUS_RX_SIZE];
+static CANBus_Status_t gCANBusStatusBuffer[CANBUS_STATUS_SIZE];
+
+// The hardware numbers filters separately for each FIFO.
+// This maps them back to their position across all banks.
+static uint8_t gCANBusFilterMap[2][CANBUS_FILTER_MAX];
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+bool CANBus_Init(void)
+{
+	// This captures the bit timer into every mailbox and FIFO entry.
+	// Transmit timestamps are only sent if TGT is set in the mailbox.
+	bool ready = CANBus_SetMode(CAN_MCR_TTCM | (gCANBus.auto_recovery ? CAN_MCR_ABOM : 0),
+				   gCANBus.auto_recovery ? 0 : CAN_MCR_ABOM);
+	// Leaving initialisation waits for 11 recessive bits, which a stuck bus
+	// may never give. Nothing below needs normal mode, so do not wait for it.
+
+	// Frames already in the ring are kept across a re-init.
+	if (gCANBus.rx.buffer == NULL)
+	{
+		Packed_Init(&gCANBus.rx, gCANBusRxBuffer, sizeof(gCANBusRxBuffer), CANBUS_RX_EXTRA);
+		Queue_Init(&gCANBus.changes, gCANBusStatusBuffer, sizeof(*gCANBusStatusBuffer), LENGTH(gCANBusStatusBuffer));
+	}
+
+	// Recieved frames, completed transmits, bus errors, changes of error state
+	// and FIFO overruns are handled in the IRQ.
+	CAN->TSR = CANBUS_RQCP;
+	CAN->IER = CAN_IER_TMEIE
+			| CAN_IER_FMPIE0 | CAN_IER_FMPIE1
+			| CAN_IER_ERRIE | CAN_IER_LECIE
+			| CAN_IER_EWGIE | CAN_IER_EPVIE | CAN_IER_BOFIE
+			| CAN_IER_FOVIE0 | CAN_IER_FOVIE1;
+	HAL_NVIC_EnableIRQ(CEC_CAN_IRQn);
+	return ready;
+}
+
+void CANBus_SetFilters(const CANBus_Filter_t * filters, uint32_t count)
+{
+	CAN->FMR |= CAN_FMR_FINIT;
+	CAN->FA1R = 0;
+
+	for (uint32_t i = 0; i < CANBUS_FILTER_BANKS; i++)
+	{
+		// Unused banks are left as an inactive 32 bit mask on FIFO0.
+		uint8_t flags = i < count ? filters[i].flags : CANBUS_FILTER_32BIT;
+		uint32_t bit = 1 << i;
+
+		if (flags & CANBUS_FILTER_32BIT) { CAN->FS1R |= bit; }
+		else { CAN->FS1R &= ~bit; }
+		if (flags & CANBUS_FILTER_LIST) { CAN->FM1R |= bit; }
+		else { CAN->FM1R &= ~bit; }
+		if (flags & CANBUS_FILTER_FIFO1) { CAN->FFA1R |= bit; }
+		else { CAN->FFA1R &= ~bit; }
+
+		if (i < count)
+		{
+			CAN->sFilterRegister[i].FR1 = filters[i].fr1;
+			CAN->sFilterRegister[i].FR2 = filters[i].fr2;
+			CAN->FA1R |= bit;
+		}
+	}
+
+	CANBus_MapFilters();
+	CAN->FMR &= ~CAN_FMR_FINIT;
+}
+
+void CANBus_SpreadFilter(void)
+{
+	// Bank 0 keeps the frames with the spread bit clear, and bank 1 takes the
+	// rest into FIFO1. This doubles the hardware buffering to six frames.
+	// If the filter already decides the bit, one bank simply never matches.
+	CAN->FMR |= CAN_FMR_FINIT;
+	uint32_t id = CAN->sFilterRegister[0].FR1;
+	uint32_t mask = CAN->sFilterRegister[0].FR2 | CANBUS_SPREAD_BIT;
+
+	CAN->FA1R &= ~(CAN_FA1R_FACT0 | CAN_FA1R_FACT1);
+	CAN->sFilterRegister[0].FR1 = id & ~CANBUS_SPREAD_BIT;
+	CAN->sFilterRegister[0].FR2 = mask;
+	CAN->sFilterRegister[1].FR1 = id | CANBUS_SPREAD_BIT;
+	CAN->sFilterRegister[1].FR2 = mask;
+
+	// Bank 1 is a 32 bit mask, like bank 0, but feeds FIFO1.
+	CAN->FS1R |= CAN_FS1R_FSC1;
+	CAN->FM1R &= ~CAN_FM1R_FBM1;
+	CAN->FFA1R |= CAN_FFA1R_FFA1;
+	CAN->FA1R = CAN_FA1R_FACT0 | CAN_FA1R_FACT1;
+
+	// Both halves report as the one filter.
+	CANBus_MapFilters();
+	gCANBusFilterMap[1][0] = 0;
+	CAN->FMR &= ~CAN_FMR_FINIT;
+}
+
+bool CANBus_Read(CANBus_Frame_t * frame)
+{
+	uint8_t extra[CANBUS_RX_EXTRA];
+	if (!Packed_Pop(&gCANBus.rx, &frame->msg, extra))
+	{
+		return false;
+	}
+	frame->time = extra[0] | (extra[1] << 8);
+	uint32_t now = CORE_GetTick() >> CANBUS_TICK_SHIFT;
+	frame->tick = (now - (uint8_t)(now - extra[2])) << CANBUS_TICK_SHIFT;
+	frame->filter = extra[3];
+	return true;
+}
+
+void CANBus_GetStats(CANBus_Stats_t * stats)
+{
+	*stats = gCANBus.stats;
+}
+
+void CANBus_GetBitTiming(uint32_t * bitrate, uint16_t * sample_point)
+{
+	// Each bit is one quantum of sync, then the two segments either side of the sample point.
+	uint32_t btr = CAN->BTR;
+	uint32_t prescaler = ((btr & CAN_BTR_BRP) >> CAN_BTR_BRP_Pos) + 1;
+	uint32_t ts1 = ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos) + 1;
+	uint32_t ts2 = ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos) + 1;
+	uint32_t quanta = 1 + ts1 + ts2;
+
+	*bitrate = HAL_RCC_GetPCLK1Freq() / (prescaler * quanta);
+	*sample_point = (1 + ts1) * 1000 / quanta;
+}
+
+void CANBus_GetStatus(CANBus_Status_t * status)
+{
+	uint32_t esr = CAN->ESR;
+	*status = gCANBus.status;
+	status->tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	status->rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+}
+
+bool CANBus_ReadStatus(CANBus_Status_t * status)
+{
+	// The IRQ also checks the state, so hold it off while we do.
+	NVIC_DisableIRQ(CEC_CAN_IRQn);
+	CANBus_CheckState();
+	NVIC_EnableIRQ(CEC_CAN_IRQn);
+
+	return Queue_Pop(&gCANBus.changes, status);
+}
+
+bool CANBus_SetAutoRecovery(bool enable)
+{
+	// Kept even if the mode does not take, so the next init applies it.
+	gCANBus.auto_recovery = enable;
+	return CANBus_SetMode(enable ? CAN_MCR_ABOM : 0, enable ? 0 : CAN_MCR_ABOM);
+}
+
+bool CANBus_Recover(void)
+{
+	return CANBus_SetMode(0, 0);
+}
+
+bool CANBus_WriteFree(void)
+{
+	return CAN->TSR & CAN_TSR_TME;
+}
+
+void CANBus_Write(const CAN_Msg_t * msg)
+{
+	CANBus_WriteMailbox(CANBus_EncodeId(msg->id, msg->ext), msg->len,
+						(msg->data[0] <<  0)
+					  | (msg->data[1] <<  8)
+					  | (msg->data[2] << 16)
+					  | (msg->data[3] << 24),
+						(msg->data[4] <<  0)
+					  | (msg->data[5] <<  8)
+					  | (msg->data[6] << 16)
+					  | (msg->data[7] << 24));
+}
+
+void CANBus_WritePacked(Packed_t * ring, const Packed_Frame_t * frame)
+{
+	// The payload goes from the ring to the mailbox a word at a time.
+	CANBus_WriteMailbox(CANBus_EncodeId(frame->id, frame->ext), frame->len,
+						Packed_ReadWord(ring, frame, 0),
+						Packed_ReadWord(ring, frame, 4));
+}
+
+bool CANBus_WritePending(uint32_t id, bool ext)
+{
+	// In priority mode the lowest mailbox wins between equal IDs,
+	// so a second message with the same ID could overtake the first.
+	uint32_t tir = CANBus_EncodeId(id, ext);
+	uint32_t tsr = CAN->TSR;
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		if (!(tsr & (CAN_TSR_TME0 << i)) && (CAN->sTxMailBox[i].TIR & CANBUS_TIR_ID) == tir)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CANBus_WriteKick(void)
+{
+	gCANBus.kick = true;
+	NVIC_SetPendingIRQ(CEC_CAN_IRQn);
+}
+
+void CANBus_OnTransmit(void (*callback)(void))
+{
+	gCANBus.on_transmit = callback;
+}
+
+void CANBus_OnError(void (*callback)(CAN_Error_t error))
+{
+	gCANBus.on_error = callback;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void CANBus_ReadMailbox(uint32_t fifo, CANBus_Frame_t * frame)
+{
+	CAN_FIFOMailBox_TypeDef * mailbox = &CAN->sFIFOMailBox[fifo];
+
+	uint32_t rir = mailbox->RIR;
+	uint32_t rdtr = mailbox->RDTR;
+
+	frame->msg.ext = rir & CAN_RI0R_IDE;
+	frame->msg.id = frame->msg.ext
+			? (rir >> CAN_RI0R_EXID_Pos)
+			: (rir >> CAN_RI0R_STID_Pos);
+	frame->msg.len = (rdtr & CAN_RDT0R_DLC) >> CAN_RDT0R_DLC_Pos;
+	if (frame->msg.len > 8) { frame->msg.len = 8; }
+	frame->time = (rdtr & CAN_RDT0R_TIME) >> CAN_RDT0R_TIME_Pos;
+
+	uint32_t fmi = (rdtr & CAN_RDT0R_FMI) >> CAN_RDT0R_FMI_Pos;
+	frame->filter = fmi < CANBUS_FILTER_MAX ? gCANBusFilterMap[fifo][fmi] : CANBUS_FILTER_NONE;
+
+	uint32_t low = mailbox->RDLR;
+	uint32_t high = mailbox->RDHR;
+	frame->msg.data[0] = low >> 0;
+	frame->msg.data[1] = low >> 8;
+	frame->msg.data[2] = low >> 16;
+	frame->msg.data[3] = low >> 24;
+	frame->msg.data[4] = high >> 0;
+	frame->msg.data[5] = high >> 8;
+	frame->msg.data[6] = high >> 16;
+	frame->msg.data[7] = high >> 24;
+}
+
+static uint32_t CANBus_FilterCount(uint32_t bank)
+{
+	// 32 bit masks hold one filter, and each halving of the scale or switch to a list doubles it.
+	uint32_t count = (CAN->FS1R & (1 << bank)) ? 1 : 2;
+	return (CAN->FM1R & (1 << bank)) ? count * 2 : count;
+}
+
+static void CANBus_MapFilters(void)
+{
+	// Every bank is numbered, active or not, in the FIFO it is assigned to.
+	uint32_t next[2] = {0};
+	uint32_t index = 0;
+	memset(gCANBusFilterMap, CANBUS_FILTER_NONE, sizeof(gCANBusFilterMap));
+
+	for (uint32_t bank = 0; bank < CANBUS_FILTER_BANKS; bank++)
+	{
+		uint32_t fifo = (CAN->FFA1R & (1 << bank)) ? 1 : 0;
+		bool active = CAN->FA1R & (1 << bank);
+		for (uint32_t i = CANBus_FilterCount(bank); i > 0; i--)
+		{
+			gCANBusFilterMap[fifo][next[fifo]++] = active ? index++ : CANBUS_FILTER_NONE;
+		}
+	}
+}
+
+static void CANBus_CheckState(void)
+{
+	uint32_t esr = CAN->ESR;
+	CANBus_State_t state = (esr & CAN_ESR_BOFF) ? CANBus_State_BusOff
+						 : (esr & CAN_ESR_EPVF) ? CANBus_State_Passive
+						 : (esr & CAN_ESR_EWGF) ? CANBus_State_Warning
+						 : CANBus_State_Active;
+	if (state == gCANBus.status.state)
+	{
+		return;
+	}
+
+	if (state == CANBus_State_BusOff) { gCANBus.status.bus_offs += 1; }
+	gCANBus.status.state = state;
+	gCANBus.status.tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	gCANBus.status.rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+	gCANBus.status.time = TIM_Read(TIM_2);
+
+	// A full queue drops the change, but the status still holds the latest state.
+	Queue_Push(&gCANBus.changes, &gCANBus.status);
+}
+
+static bool CANBus_SetMode(uint32_t set, uint32_t clear)
+{
+	// Some modes can only be changed while initialising. A pass through
+	// initialisation is also how a bus off is recovered by hand.
+	CAN->MCR |= CAN_MCR_INRQ;
+	uint32_t start = TIM_Read(TIM_2);
+	while (!(CAN->MSR & CAN_MSR_INAK))
+	{
+		if (TIM_Read(TIM_2) - start > CANBUS_INIT_TIMEOUT_US)
+		{
+			// Withdraw the request, so the controller carries on as it was.
+			CAN->MCR &= ~CAN_MCR_INRQ;
+			return false;
+		}
+	}
+
+	CAN->MCR = (CAN->MCR | set) & ~clear;
+
+	// Leaving initialisation starts the count of recessive bits. A bus held
+	// dominant would never let it finish, so do not wait for it.
+	CAN->MCR &= ~CAN_MCR_INRQ;
+	return true;
+}
+
+static uint32_t CANBus_EncodeId(uint32_t id, bool ext)
+{
+	return ext
+		? (id << CAN_TI0R_EXID_Pos) | CAN_TI0R_IDE
+		: (id << CAN_TI0R_STID_Pos);
+}
+
+static void CANBus_WriteMailbox(uint32_t tir, uint32_t len, uint32_t low, uint32_t high)
+{
+	// The mailbox chosen does not matter, as CAN_Mode_TransmitFIFO sends in request order.
+	uint32_t index = (CAN->TSR & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos;
+	CAN_TxMailBox_TypeDef * mailbox = &CAN->sTxMailBox[index];
+
+	mailbox->TDTR = len;
+	mailbox->TDLR = low;
+	mailbox->TDHR = high;
+
+	// Writing the ID last requests the transmit.
+	mailbox->TIR = tir | CAN_TI0R_TXRQ;
+}
+
+static void CANBus_DrainFifos(void)
+{
+	// Empty both FIFOs while we are here. When both hold frames, the earlier
+	// timestamp goes first, so the ring stays in bus order.
+	while (1)
+	{
+		bool fifo0 = CAN->RF0R & CAN_RF0R_FMP0;
+		bool fifo1 = CAN->RF1R & CAN_RF1R_FMP1;
+		if (fifo0 && fifo1)
+		{
+			uint16_t time0 = CAN->sFIFOMailBox[0].RDTR >> CAN_RDT0R_TIME_Pos;
+			uint16_t time1 = CAN->sFIFOMailBox[1].RDTR >> CAN_RDT1R_TIME_Pos;
+			fifo0 = (int16_t)(time1 - time0) >= 0;
+		}
+
+		if (fifo0)
+		{
+			CANBus_StoreFrame(0);
+			CAN->RF0R = CAN_RF0R_RFOM0;
+		}
+		else if (fifo1)
+		{
+			CANBus_StoreFrame(1);
+			CAN->RF1R = CAN_RF1R_RFOM1;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	uint32_t count = Packed_Count(&gCANBus.rx);
+	if (count > gCANBus.stats.peak) { gCANBus.stats.peak = count; }
+}
+
+static void CANBus_StoreFrame(uint32_t fifo)
+{
+	CANBus_Frame_t frame;
+	CANBus_ReadMailbox(fifo, &frame);
+	uint8_t extra[CANBUS_RX_EXTRA] = {
+		frame.time >> 0,
+		frame.time >> 8,
+		CORE_GetTick() >> CANBUS_TICK_SHIFT,
+		frame.filter,
+	};
+
+	if (Packed_Push(&gCANBus.rx, &frame.msg, extra))
+	{
+		gCANBus.stats.recieved += 1;
+	}
+	else
+	{
+		gCANBus.stats.dropped += 1;
+		if (gCANBus.on_error) { gCANBus.on_error(CAN_Error_RxOverrun); }
+	}
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
+void CEC_CAN_IRQHandler(void)
+{
+	uint32_t tsr = CAN->TSR;
+	if ((tsr & CANBUS_RQCP) || gCANBus.kick)
+	{
+		// Writing the flags back clears them.
+		CAN->TSR = tsr & CANBUS_RQCP;
+		gCANBus.kick = false;
+		if (gCANBus.on_transmit) { gCANBus.on_transmit(); }
+	}
+
+	if (CAN->MSR & CAN_MSR_ERRI)
+	{
+		// The last error codes align with CAN_Error_t
+		CAN_Error_t error = (CAN->ESR & CAN_ESR_LEC) >> CAN_ESR_LEC_Pos;
+		CAN->ESR &= ~CAN_ESR_LEC;
+		CAN->MSR = CAN_MSR_ERRI;
+		if (error != CAN_Error_None)
+		{
+			gCANBus.status.last_error = error;
+			if (gCANBus.on_error) { gCANBus.on_error(error); }
+		}
+
+		// Entering warning, passive or bus off also raises this interrupt.
+		CANBus_CheckState();
+	}
+
+	CANBus_DrainFifos();
+
+	if ((CAN->RF0R & CAN_RF0R_FOVR0) || (CAN->RF1R & CAN_RF1R_FOVR1))
+	{
+		gCANBus.stats.overruns += ((CAN->RF0R & CAN_RF0R_FOVR0) ? 1 : 0)
+								+ ((CAN->RF1R & CAN_RF1R_FOVR1) ? 1 : 0);
+		CAN->RF0R = CAN_RF0R_FOVR0;
+		CAN->RF1R = CAN_RF1R_FOVR1;
+		if (gCANBus.on_error) { gCANBus.on_error(CAN_Error_RxOverrun); }
+	}
+}
+
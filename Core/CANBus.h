@@ -0,0 +1,113 @@
+#ifndef CANBUS_H
+#define CANBUS_H
+
+#include "STM32X.h"
+#include "CAN.h"
+#include "Packed.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+#define CANBUS_FILTER_BANKS		14
+
+// Filter bank flags
+#define CANBUS_FILTER_32BIT		(1 << 0)
+#define CANBUS_FILTER_LIST		(1 << 1)
+#define CANBUS_FILTER_FIFO1		(1 << 2)
+
+#define CANBUS_FILTER_NONE		0xFF
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	CAN_Msg_t msg;
+	uint16_t time; // Bit time captured at the start of frame
+	uint32_t tick; // Millisecond tick when recieved, to within 16ms
+	uint8_t filter; // Index of the matching filter, counted across all banks
+} CANBus_Frame_t;
+
+typedef struct {
+	// Filter bank registers, in the bxCAN layout
+	uint32_t fr1;
+	uint32_t fr2;
+	uint8_t flags;
+} CANBus_Filter_t;
+
+typedef enum {
+	CANBus_State_Active,
+	CANBus_State_Warning, // An error counter has reached 96
+	CANBus_State_Passive, // An error counter has passed 127
+	CANBus_State_BusOff, // The transmit error counter has passed 255
+} CANBus_State_t;
+
+typedef struct {
+	CANBus_State_t state;
+	uint8_t tec; // Transmit and recieve error counters
+	uint8_t rec;
+	CAN_Error_t last_error;
+	uint32_t bus_offs; // Entries into bus off since startup
+	uint32_t time; // Microsecond timebase when the state was entered
+} CANBus_Status_t;
+
+typedef struct {
+	uint32_t recieved;
+	uint32_t dropped; // Lost to a full recieve ring
+	uint32_t overruns; // Hardware FIFO overruns, each losing at least one frame
+	uint32_t peak; // Most frames held in the recieve ring
+} CANBus_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Extends the controller set up by CAN_Init. False if the time triggered and
+// recovery modes could not be set, as the controller did not enter initialisation.
+bool CANBus_Init(void);
+// Replaces every filter bank. Banks past the count are disabled.
+void CANBus_SetFilters(const CANBus_Filter_t * filters, uint32_t count);
+// Splits filter bank 0 over both recieve FIFOs
+void CANBus_SpreadFilter(void);
+bool CANBus_Read(CANBus_Frame_t * frame);
+void CANBus_GetStats(CANBus_Stats_t * stats);
+// The bit timing achieved by the controller. The sample point is in tenths of a percent.
+void CANBus_GetBitTiming(uint32_t * bitrate, uint16_t * sample_point);
+
+// The counters are read live. The state is as of the last change seen.
+void CANBus_GetStatus(CANBus_Status_t * status);
+// Changes of state, in order, to be read from the main loop.
+// Leaving a state raises no interrupt, so this also polls for those.
+bool CANBus_ReadStatus(CANBus_Status_t * status);
+
+// With automatic recovery, the controller rejoins the bus by itself after
+// 128 runs of 11 recessive bits. Otherwise it waits in bus off for CANBus_Recover.
+// False if the controller did not enter initialisation in time. The setting is
+// still kept for the next CANBus_Init.
+bool CANBus_SetAutoRecovery(bool enable);
+// Starts the recovery sequence. This waits up to 20ms for the controller to enter
+// initialisation, and is false if it did not, but does not wait for the recovery.
+// The controller must be running, so not while it is released.
+bool CANBus_Recover(void);
+
+// Safe to call from the transmit callback.
+bool CANBus_WriteFree(void);
+void CANBus_Write(const CAN_Msg_t * msg);
+// Writes the frame at the tail of a ring straight into a mailbox. It is not released.
+void CANBus_WritePacked(Packed_t * ring, const Packed_Frame_t * frame);
+// True if a message with the same ID is waiting in a mailbox.
+bool CANBus_WritePending(uint32_t id, bool ext);
+// Runs the transmit callback from the CAN IRQ, as if a mailbox had just freed.
+// This lets other IRQs load the mailboxes without racing the transmit callback.
+void CANBus_WriteKick(void);
+
+// These callbacks run in the CAN interrupt.
+void CANBus_OnTransmit(void (*callback)(void));
+void CANBus_OnError(void (*callback)(CAN_Error_t error));
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //CANBUS_H
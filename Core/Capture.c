@@ -0,0 +1,215 @@
+#include "Capture.h"
+#include "Packed.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static bool Capture_Match(const CAN_Msg_t * msg);
+static void Capture_Trigger(Capture_Trigger_t trigger, uint32_t before);
+static bool Capture_Append(const CAN_Msg_t * msg, uint32_t timestamp);
+static void Capture_Drop(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	// Frames are packed with their timestamp. This is 14 bytes for a
+	// standard frame of 8 bytes, against 24 for a CANBus_Frame_t.
+	Packed_t ring;
+	uint8_t * buffer;
+	Capture_Match_t match;
+	uint16_t pre;
+	uint16_t post;
+	uint16_t remaining; // Frames still to record after the trigger
+	bool reported;
+	Capture_Stats_t stats;
+} gCapture;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Capture_Init(void * buffer)
+{
+	gCapture.buffer = buffer;
+	Capture_Stop();
+}
+
+bool Capture_IsIdle(void)
+{
+	return gCapture.stats.state == Capture_State_Idle;
+}
+
+void Capture_Arm(const Capture_Match_t * match, uint16_t pre, uint16_t post)
+{
+	Packed_Init(&gCapture.ring, gCapture.buffer, CAPTURE_SIZE, sizeof(uint32_t));
+	gCapture.match = *match;
+	gCapture.pre = pre;
+	gCapture.post = post;
+	gCapture.stats.frames = 0;
+	gCapture.stats.before = 0;
+	gCapture.stats.trigger = Capture_Trigger_None;
+	gCapture.stats.state = Capture_State_Armed;
+}
+
+void Capture_Stop(void)
+{
+	Packed_Init(&gCapture.ring, gCapture.buffer, CAPTURE_SIZE, sizeof(uint32_t));
+	gCapture.stats.frames = 0;
+	gCapture.stats.before = 0;
+	gCapture.stats.state = Capture_State_Idle;
+}
+
+bool Capture_Frame(const CAN_Msg_t * msg, uint32_t timestamp)
+{
+	switch (gCapture.stats.state)
+	{
+	case Capture_State_Armed:
+		Capture_Append(msg, timestamp);
+		if (gCapture.match.trigger == Capture_Trigger_Frame && Capture_Match(msg))
+		{
+			// The trigger frame is kept, after those before it.
+			Capture_Trigger(Capture_Trigger_Frame, gCapture.stats.frames - 1);
+		}
+		else
+		{
+			while (gCapture.stats.frames > gCapture.pre)
+			{
+				Capture_Drop();
+			}
+		}
+		return true;
+
+	case Capture_State_Triggered:
+		// Stop early rather than lose frames after the trigger.
+		if (!Capture_Append(msg, timestamp) || --gCapture.remaining == 0)
+		{
+			gCapture.stats.state = Capture_State_Done;
+		}
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void Capture_Event(Capture_Trigger_t trigger, uint8_t code)
+{
+	if (gCapture.stats.state == Capture_State_Armed
+		&& (trigger == Capture_Trigger_Manual
+			|| (trigger == gCapture.match.trigger
+				&& (trigger != Capture_Trigger_Error || gCapture.match.error == CAPTURE_ERROR_ANY || gCapture.match.error == code))))
+	{
+		Capture_Trigger(trigger, gCapture.stats.frames);
+	}
+}
+
+bool Capture_Poll(Capture_Stats_t * stats)
+{
+	if (gCapture.stats.state == Capture_State_Done && !gCapture.reported)
+	{
+		gCapture.reported = true;
+		*stats = gCapture.stats;
+		return true;
+	}
+	return false;
+}
+
+bool Capture_Read(CAN_Msg_t * msg, uint32_t * timestamp)
+{
+	if (gCapture.stats.state != Capture_State_Done || !gCapture.reported)
+	{
+		return false;
+	}
+	if (!Packed_Pop(&gCapture.ring, msg, timestamp))
+	{
+		// The whole snapshot has been read.
+		gCapture.stats.state = Capture_State_Idle;
+		return false;
+	}
+
+	gCapture.stats.frames -= 1;
+	return true;
+}
+
+void Capture_GetStats(Capture_Stats_t * stats)
+{
+	*stats = gCapture.stats;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static bool Capture_Match(const CAN_Msg_t * msg)
+{
+	const Capture_Match_t * match = &gCapture.match;
+	if (msg->ext != match->ext || ((msg->id ^ match->id) & match->id_mask))
+	{
+		return false;
+	}
+
+	// Masked bytes past the end of the payload never match.
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		if (match->data_mask[i] && (i >= msg->len || ((msg->data[i] ^ match->data[i]) & match->data_mask[i])))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void Capture_Trigger(Capture_Trigger_t trigger, uint32_t before)
+{
+	gCapture.stats.trigger = trigger;
+	gCapture.stats.before = before;
+	gCapture.remaining = gCapture.post;
+	gCapture.reported = false;
+	gCapture.stats.state = gCapture.post ? Capture_State_Triggered : Capture_State_Done;
+}
+
+static bool Capture_Append(const CAN_Msg_t * msg, uint32_t timestamp)
+{
+	// Make room by dropping the oldest frames. Once triggered, only frames
+	// from before the trigger may go.
+	// Everything runs in the main loop, so the one side may do both.
+	while (!Packed_Push(&gCapture.ring, msg, &timestamp))
+	{
+		if (gCapture.stats.state == Capture_State_Triggered)
+		{
+			if (gCapture.stats.before == 0)
+			{
+				return false;
+			}
+			gCapture.stats.before -= 1;
+			gCapture.stats.overwritten += 1;
+		}
+		Capture_Drop();
+	}
+
+	gCapture.stats.frames += 1;
+	gCapture.stats.recorded += 1;
+	return true;
+}
+
+static void Capture_Drop(void)
+{
+	Packed_Release(&gCapture.ring);
+	gCapture.stats.frames -= 1;
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
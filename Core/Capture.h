@@ -0,0 +1,85 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// Must be a power of two. Frames are packed, so this holds 73 frames of 8 bytes,
+// or more when they are shorter.
+#define CAPTURE_SIZE		1024
+
+// Matches any error code
+#define CAPTURE_ERROR_ANY	0xFF
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef enum {
+	Capture_State_Idle,
+	Capture_State_Armed, // Recording, and waiting on the trigger
+	Capture_State_Triggered, // Recording the frames after the trigger
+	Capture_State_Done, // Holding the snapshot until it is read
+} Capture_State_t;
+
+typedef enum {
+	Capture_Trigger_None,
+	Capture_Trigger_Frame,
+	Capture_Trigger_Error,
+	Capture_Trigger_BusOff,
+	Capture_Trigger_Manual, // Fires any armed capture
+} Capture_Trigger_t;
+
+typedef struct {
+	Capture_Trigger_t trigger;
+	// A frame matches when the masked bits of its ID and payload do.
+	uint32_t id;
+	uint32_t id_mask;
+	bool ext;
+	uint8_t data[8];
+	uint8_t data_mask[8];
+	uint8_t error;
+} Capture_Match_t;
+
+typedef struct {
+	Capture_State_t state;
+	Capture_Trigger_t trigger; // What fired the last capture
+	uint32_t frames; // Held in the buffer
+	uint32_t before; // Held from before the trigger. The trigger frame follows these.
+	uint32_t recorded;
+	uint32_t overwritten; // Frames from before the trigger dropped to make room for those after
+} Capture_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// The buffer holds CAPTURE_SIZE bytes. It is only used while a capture is armed or
+// held, so may be shared with something that is never used alongside one.
+void Capture_Init(void * buffer);
+bool Capture_IsIdle(void);
+
+// Discards any capture, and starts recording. At most pre frames are kept
+// from before the trigger, and recording stops post frames after it.
+void Capture_Arm(const Capture_Match_t * match, uint16_t pre, uint16_t post);
+void Capture_Stop(void);
+
+// Records the frame, and returns true, while a capture is in progress.
+bool Capture_Frame(const CAN_Msg_t * msg, uint32_t timestamp);
+// Triggers on events that are not frames. The code is only checked for errors.
+void Capture_Event(Capture_Trigger_t trigger, uint8_t code);
+
+// True once when a capture completes. The snapshot is then read out in order.
+bool Capture_Poll(Capture_Stats_t * stats);
+bool Capture_Read(CAN_Msg_t * msg, uint32_t * timestamp);
+void Capture_GetStats(Capture_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //CAPTURE_H
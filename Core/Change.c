@@ -0,0 +1,128 @@
+#include "Change.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+// Entries are kept in an open addressed hash table, at most three quarters full.
+#define CHANGE_HASH_BITS	6
+#define CHANGE_HASH_SIZE	(1 << CHANGE_HASH_BITS)
+#define CHANGE_KEY_EMPTY	0xFFFFFFFF
+#define CHANGE_KEY_EXT		(1 << 31)
+#define CHANGE_ID_BITS		0x1FFFFFFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+// 20 bytes, so the table costs 1.25KB.
+typedef struct {
+	uint32_t key; // ID, with the extended flag in the top bit
+	uint32_t tick; // When the entry was last forwarded, kept whole so long gaps do not wrap
+	uint8_t len;
+	uint8_t data[8];
+} Change_Entry_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static Change_Entry_t * Change_Find(uint32_t key);
+static uint32_t Change_Hash(uint32_t key);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	Change_Entry_t entries[CHANGE_HASH_SIZE];
+	uint16_t refresh;
+	Change_Stats_t stats;
+} gChange;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Change_Init(void)
+{
+	Change_Clear(0);
+}
+
+void Change_Clear(uint16_t refresh)
+{
+	for (uint32_t i = 0; i < CHANGE_HASH_SIZE; i++)
+	{
+		gChange.entries[i].key = CHANGE_KEY_EMPTY;
+	}
+	gChange.refresh = refresh;
+	gChange.stats.ids = 0;
+}
+
+bool Change_Forward(const CAN_Msg_t * msg, uint32_t tick)
+{
+	uint32_t key = (msg->id & CHANGE_ID_BITS) | (msg->ext ? CHANGE_KEY_EXT : 0);
+	Change_Entry_t * entry = Change_Find(key);
+	if (entry == NULL)
+	{
+		gChange.stats.uncached += 1;
+		gChange.stats.forwarded += 1;
+		return true;
+	}
+
+	if (entry->key == key
+		&& entry->len == msg->len
+		&& memcmp(entry->data, msg->data, msg->len) == 0
+		&& (gChange.refresh == 0 || tick - entry->tick < gChange.refresh))
+	{
+		gChange.stats.suppressed += 1;
+		return false;
+	}
+
+	if (entry->key == CHANGE_KEY_EMPTY)
+	{
+		entry->key = key;
+		gChange.stats.ids += 1;
+	}
+	entry->tick = tick;
+	entry->len = msg->len;
+	memcpy(entry->data, msg->data, msg->len);
+	gChange.stats.forwarded += 1;
+	return true;
+}
+
+void Change_GetStats(Change_Stats_t * stats)
+{
+	*stats = gChange.stats;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static Change_Entry_t * Change_Find(uint32_t key)
+{
+	// Returns the entry for the key, or a free slot to claim for it.
+	// Once the table is full, only existing entries are returned.
+	for (uint32_t slot = Change_Hash(key); ; slot = (slot + 1) & (CHANGE_HASH_SIZE - 1))
+	{
+		Change_Entry_t * entry = &gChange.entries[slot];
+		if (entry->key == key)
+		{
+			return entry;
+		}
+		if (entry->key == CHANGE_KEY_EMPTY)
+		{
+			return gChange.stats.ids < CHANGE_IDS_MAX ? entry : NULL;
+		}
+	}
+}
+
+static uint32_t Change_Hash(uint32_t key)
+{
+	return (key * 2654435761u) >> (32 - CHANGE_HASH_BITS);
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
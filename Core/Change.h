@@ -0,0 +1,44 @@
+#ifndef CHANGE_H
+#define CHANGE_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// The most IDs whose payload is remembered. Further IDs are always forwarded.
+#define CHANGE_IDS_MAX		48
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t ids; // IDs in the table
+	uint32_t forwarded;
+	uint32_t suppressed; // Frames dropped as unchanged
+	uint32_t uncached; // Frames forwarded because the table was full
+} Change_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Change_Init(void);
+
+// Forgets every payload, so the next frame of each ID is forwarded.
+// A refresh of zero never forwards an unchanged frame.
+void Change_Clear(uint16_t refresh);
+// True if the frame differs from the last one forwarded with its ID,
+// or the refresh interval has passed. The tick is in milliseconds.
+bool Change_Forward(const CAN_Msg_t * msg, uint32_t tick);
+
+void Change_GetStats(Change_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //CHANGE_H
@@ -0,0 +1,54 @@
+
+#include "Checksum.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Checksum_Init(void)
+{
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	// The peripheral defaults to the CRC-32 polynomial and seed.
+	// Bit reversing the input bytes and output word gives the reflected form.
+	CRC->INIT = 0xFFFFFFFF;
+	CRC->POL = 0x04C11DB7;
+	CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+}
+
+uint32_t Checksum_Crc32(const uint8_t * data, uint32_t size)
+{
+	CRC->CR |= CRC_CR_RESET;
+
+	while (size--)
+	{
+		*(__IO uint8_t *)&CRC->DR = *data++;
+	}
+
+	return CRC->DR ^ 0xFFFFFFFF;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
@@ -0,0 +1,27 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "STM32X.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+/*
+ * PUBLIC TYPES
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Checksum_Init(void);
+
+// Standard CRC-32, as used by zlib and ethernet.
+uint32_t Checksum_Crc32(const uint8_t * data, uint32_t size);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //CHECKSUM_H
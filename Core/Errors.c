@@ -0,0 +1,121 @@
+#include "Errors.h"
+#include "TIM.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+// Errors are coalesced as they are raised, so a burst takes one slot per code
+// and nothing is lost however long the main loop takes to report it.
+static struct {
+	struct {
+		uint32_t count; // Since the last report
+		uint32_t first;
+		uint32_t last;
+		uint32_t total;
+		uint32_t reported; // Time of the last report
+	} codes[ERRORS_CODES];
+	uint32_t raised;
+	uint32_t next; // The code to check first, so that none are starved
+} gErrors;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Errors_Init(void)
+{
+	uint32_t now = TIM_Read(TIM_2);
+
+	__disable_irq();
+	for (uint32_t i = 0; i < ERRORS_CODES; i++)
+	{
+		gErrors.codes[i].count = 0;
+		gErrors.codes[i].total = 0;
+		// The first occurrence of each code is reported without delay.
+		gErrors.codes[i].reported = now - ERRORS_INTERVAL_US;
+	}
+	gErrors.raised = 0;
+	gErrors.next = 0;
+	__enable_irq();
+}
+
+void Errors_Raise(uint8_t code)
+{
+	if (code >= ERRORS_CODES) { code = 0; }
+	uint32_t now = TIM_Read(TIM_2);
+
+	// This may be called with IRQs already masked, so restore the mask as it was.
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (gErrors.codes[code].count == 0)
+	{
+		gErrors.codes[code].first = now;
+	}
+	gErrors.codes[code].last = now;
+	gErrors.codes[code].count += 1;
+	gErrors.codes[code].total += 1;
+	gErrors.raised |= 1 << code;
+	__set_PRIMASK(primask);
+}
+
+uint32_t Errors_Raised(void)
+{
+	__disable_irq();
+	uint32_t raised = gErrors.raised;
+	gErrors.raised = 0;
+	__enable_irq();
+	return raised;
+}
+
+bool Errors_Read(Errors_Report_t * report)
+{
+	uint32_t now = TIM_Read(TIM_2);
+	for (uint32_t i = 0; i < ERRORS_CODES; i++)
+	{
+		uint32_t code = (gErrors.next + i) % ERRORS_CODES;
+		if (gErrors.codes[code].count == 0 || now - gErrors.codes[code].reported < ERRORS_INTERVAL_US)
+		{
+			continue;
+		}
+
+		__disable_irq();
+		report->code = code;
+		report->count = gErrors.codes[code].count;
+		report->first = gErrors.codes[code].first;
+		report->last = gErrors.codes[code].last;
+		gErrors.codes[code].count = 0;
+		__enable_irq();
+
+		gErrors.codes[code].reported = now;
+		gErrors.next = code + 1;
+		return true;
+	}
+	return false;
+}
+
+uint32_t Errors_GetTotal(uint8_t code)
+{
+	return code < ERRORS_CODES ? gErrors.codes[code].total : 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
@@ -0,0 +1,50 @@
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#include "STM32X.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// Codes above this are counted as code 0
+#define ERRORS_CODES			16
+// Each code is reported at most this often. Occurrences in between are counted.
+#define ERRORS_INTERVAL_US		100000
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint8_t code;
+	uint32_t count; // Occurrences since the last report
+	uint32_t first; // Timebase at the first and last of these, in us
+	uint32_t last;
+} Errors_Report_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Times are read from TIM_2, the microsecond timebase, which must be running.
+void Errors_Init(void);
+
+// Counts an occurrence of the code. Safe from any IRQ, and from the main loop.
+void Errors_Raise(uint8_t code);
+
+// Codes raised since the last call, as a bit each.
+// Unlike the reports, these are not held back.
+uint32_t Errors_Raised(void);
+
+// Reports the next code that has occurred, and is due. The codes take turns.
+bool Errors_Read(Errors_Report_t * report);
+
+// Occurrences of the code since init
+uint32_t Errors_GetTotal(uint8_t code);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //ERRORS_H
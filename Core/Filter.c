@@ -0,0 +1,399 @@
+
+#include "Filter.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define FILTER_STD_IDS		2048
+#define FILTER_STD_BITS		0x7FF
+#define FILTER_EXT_BITS		0x1FFFFFFF
+
+// Bank register fields for each scale
+#define FILTER_IDE16		(1 << 3)
+#define FILTER_IDE32		(1 << 2)
+#define FILTER_STD16_POS	5
+#define FILTER_STD32_POS	21
+#define FILTER_EXT32_POS	3
+
+// Extended IDs are kept in an open addressed hash set, at most half full.
+#define FILTER_HASH_BITS	7
+#define FILTER_HASH_SIZE	(1 << FILTER_HASH_BITS)
+#define FILTER_HASH_EMPTY	0xFFFFFFFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+// A run of IDs covered by a single mask.
+// The bits set in diff are left as don't care.
+typedef struct {
+	uint32_t id;
+	uint32_t diff;
+	uint32_t count;
+} Filter_Group_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static int32_t Filter_Unwanted(const Filter_Group_t * group);
+static int32_t Filter_MergeCost(const Filter_Group_t * a, const Filter_Group_t * b);
+static uint32_t Filter_MergeCheapest(Filter_Group_t * groups, uint32_t * std_count, uint32_t count);
+static uint32_t Filter_AppendGroup(Filter_Group_t * groups, uint32_t * std_count, uint32_t count, uint32_t id);
+static uint32_t Filter_BanksNeeded(const Filter_Group_t * groups, uint32_t std_count, uint32_t count);
+static uint32_t Filter_EmitBanks(const Filter_Group_t * groups, uint32_t std_count, uint32_t count, CANBus_Filter_t * banks, uint32_t max);
+static uint32_t Filter_Hash(uint32_t id);
+static bool Filter_FindExt(uint32_t id);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	uint8_t std[FILTER_BITMAP_SIZE];
+	uint32_t std_count;
+	uint32_t ext[FILTER_HASH_SIZE];
+	uint32_t ext_count;
+	bool ext_all; // Every extended ID is wanted
+	Filter_Stats_t stats;
+} gFilter;
+
+static Filter_Group_t gFilterGroups[FILTER_GROUPS_MAX];
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Filter_Init(void)
+{
+	Filter_Clear();
+}
+
+void Filter_Clear(void)
+{
+	memset(gFilter.std, 0, sizeof(gFilter.std));
+	memset(gFilter.ext, 0xFF, sizeof(gFilter.ext));
+	gFilter.std_count = 0;
+	gFilter.ext_count = 0;
+	gFilter.ext_all = false;
+	gFilter.stats.ids = 0;
+	gFilter.stats.matched = 0;
+}
+
+bool Filter_Add(uint32_t id, bool ext)
+{
+	if (!ext)
+	{
+		id &= FILTER_STD_BITS;
+		uint8_t bit = 1 << (id & 7);
+		if (!(gFilter.std[id >> 3] & bit))
+		{
+			gFilter.std[id >> 3] |= bit;
+			gFilter.std_count += 1;
+		}
+		return true;
+	}
+
+	// Linear probing from the hashed slot.
+	id &= FILTER_EXT_BITS;
+	for (uint32_t slot = Filter_Hash(id); ; slot = (slot + 1) & (FILTER_HASH_SIZE - 1))
+	{
+		if (gFilter.ext[slot] == id)
+		{
+			return true;
+		}
+		if (gFilter.ext[slot] == FILTER_HASH_EMPTY)
+		{
+			if (gFilter.ext_count >= FILTER_EXT_MAX)
+			{
+				return false;
+			}
+			gFilter.ext[slot] = id;
+			gFilter.ext_count += 1;
+			return true;
+		}
+	}
+}
+
+void Filter_PassExt(void)
+{
+	gFilter.ext_all = true;
+}
+
+void Filter_SetBitmap(uint32_t offset, const uint8_t * bits, uint32_t size)
+{
+	if (offset >= sizeof(gFilter.std)) { return; }
+	if (size > sizeof(gFilter.std) - offset) { size = sizeof(gFilter.std) - offset; }
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		gFilter.std_count -= __builtin_popcount(gFilter.std[offset + i]);
+		gFilter.std_count += __builtin_popcount(bits[i]);
+		gFilter.std[offset + i] = bits[i];
+	}
+}
+
+uint32_t Filter_Compile(CANBus_Filter_t * banks, uint32_t max)
+{
+	gFilter.stats.ids = gFilter.std_count + gFilter.ext_count;
+	if (gFilter.stats.ids == 0 && !gFilter.ext_all)
+	{
+		return 0;
+	}
+
+	// Start with every ID in its own group, in order with the standard IDs first.
+	// Long lists are merged as they are read in, so the groups fit the window.
+	Filter_Group_t * groups = gFilterGroups;
+	uint32_t count = 0;
+	uint32_t std_count = 0;
+	for (uint32_t id = 0; id < FILTER_STD_IDS; id++)
+	{
+		if (gFilter.std[id >> 3] & (1 << (id & 7)))
+		{
+			count = Filter_AppendGroup(groups, &std_count, count, id);
+			std_count = count;
+		}
+	}
+
+	// Passing every extended ID takes a single mask.
+	if (gFilter.ext_all)
+	{
+		count = Filter_AppendGroup(groups, &std_count, count, 0);
+		groups[count - 1].diff = FILTER_EXT_BITS;
+		groups[count - 1].count = gFilter.ext_count;
+	}
+
+	// The hash set is unordered, so the extended IDs are read out smallest first.
+	// An empty slot is above every ID, so it is never picked.
+	uint32_t last = 0;
+	for (uint32_t n = 0; n < gFilter.ext_count && !gFilter.ext_all; n++)
+	{
+		uint32_t next = FILTER_HASH_EMPTY;
+		for (uint32_t slot = 0; slot < FILTER_HASH_SIZE; slot++)
+		{
+			uint32_t id = gFilter.ext[slot];
+			if ((n == 0 || id > last) && id < next) { next = id; }
+		}
+		count = Filter_AppendGroup(groups, &std_count, count, next);
+		last = next;
+	}
+
+	// Merge neighbours until the groups fit into the banks.
+	while (Filter_BanksNeeded(groups, std_count, count) > max)
+	{
+		uint32_t merged = Filter_MergeCheapest(groups, &std_count, count);
+		if (merged == count)
+		{
+			break;
+		}
+		count = merged;
+	}
+
+	// Tally how much of the ID space the banks let through.
+	uint32_t matched = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t size = 1 << __builtin_popcount(groups[i].diff);
+		matched = (matched + size < matched) ? UINT32_MAX : matched + size;
+	}
+	gFilter.stats.matched = matched;
+
+	return Filter_EmitBanks(groups, std_count, count, banks, max);
+}
+
+bool Filter_Accept(const CAN_Msg_t * msg)
+{
+	// SysTick counts down CPU cycles, and wraps every millisecond.
+	uint32_t start = SysTick->VAL;
+
+	bool accept = msg->ext
+			? gFilter.ext_all || Filter_FindExt(msg->id)
+			: gFilter.std[(msg->id & FILTER_STD_BITS) >> 3] & (1 << (msg->id & 7));
+
+	uint32_t end = SysTick->VAL;
+	uint32_t cycles = start >= end ? start - end : start + SysTick->LOAD + 1 - end;
+
+	gFilter.stats.seen += 1;
+	gFilter.stats.cycles += cycles;
+	if (cycles > gFilter.stats.cycles_max) { gFilter.stats.cycles_max = cycles; }
+	if (accept) { gFilter.stats.accepted += 1; }
+	return accept;
+}
+
+void Filter_GetStats(Filter_Stats_t * stats)
+{
+	*stats = gFilter.stats;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static int32_t Filter_Unwanted(const Filter_Group_t * group)
+{
+	// Every combination of the don't care bits is let through.
+	return (1 << __builtin_popcount(group->diff)) - group->count;
+}
+
+static int32_t Filter_MergeCost(const Filter_Group_t * a, const Filter_Group_t * b)
+{
+	// The extra IDs let through by merging two groups.
+	// This can be negative where one mask already covered the other.
+	Filter_Group_t merged = {
+		.id = a->id,
+		.diff = a->diff | b->diff | (a->id ^ b->id),
+		.count = a->count + b->count,
+	};
+	return Filter_Unwanted(&merged) - Filter_Unwanted(a) - Filter_Unwanted(b);
+}
+
+static uint32_t Filter_MergeCheapest(Filter_Group_t * groups, uint32_t * std_count, uint32_t count)
+{
+	// Nearby IDs share their high bits, so neighbours make the tightest masks.
+	// Standard and extended IDs are never merged together.
+	uint32_t best = count;
+	int32_t best_cost = INT32_MAX;
+	for (uint32_t i = 0; i + 1 < count; i++)
+	{
+		if (i + 1 == *std_count) { continue; }
+
+		int32_t cost = Filter_MergeCost(&groups[i], &groups[i + 1]);
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best = i;
+		}
+	}
+	if (best == count)
+	{
+		return count;
+	}
+
+	Filter_Group_t * group = &groups[best];
+	group->diff |= groups[best + 1].diff | (group->id ^ groups[best + 1].id);
+	group->count += groups[best + 1].count;
+	memmove(&groups[best + 1], &groups[best + 2], (count - best - 2) * sizeof(*groups));
+	if (best < *std_count) { *std_count -= 1; }
+	return count - 1;
+}
+
+static uint32_t Filter_AppendGroup(Filter_Group_t * groups, uint32_t * std_count, uint32_t count, uint32_t id)
+{
+	// A full window always holds a pair to merge, as it is far larger than two.
+	if (count == FILTER_GROUPS_MAX)
+	{
+		count = Filter_MergeCheapest(groups, std_count, count);
+	}
+	groups[count] = (Filter_Group_t){ .id = id, .diff = 0, .count = 1 };
+	return count + 1;
+}
+
+static uint32_t Filter_BanksNeeded(const Filter_Group_t * groups, uint32_t std_count, uint32_t count)
+{
+	// Single IDs pack into lists, four standard or two extended to a bank.
+	// Masks take two standard or one extended to a bank.
+	uint32_t std_ids = 0;
+	uint32_t ext_ids = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (groups[i].diff == 0)
+		{
+			if (i < std_count) { std_ids += 1; }
+			else { ext_ids += 1; }
+		}
+	}
+	uint32_t std_masks = std_count - std_ids;
+	uint32_t ext_masks = (count - std_count) - ext_ids;
+
+	return (std_ids + 3) / 4 + (std_masks + 1) / 2 + (ext_ids + 1) / 2 + ext_masks;
+}
+
+static uint32_t Filter_EmitBanks(const Filter_Group_t * groups, uint32_t std_count, uint32_t count, CANBus_Filter_t * banks, uint32_t max)
+{
+	// Packs standard lists, standard masks, extended lists then extended masks.
+	// A partly filled bank repeats its last entry.
+	// Banks alternate between the FIFOs to spread the hardware buffering.
+	uint32_t bank = 0;
+
+	for (uint32_t pass = 0; pass < 4; pass++)
+	{
+		bool ext = pass >= 2;
+		bool mask = pass & 1;
+		uint32_t first = ext ? std_count : 0;
+		uint32_t last = ext ? count : std_count;
+
+		// Standard lists hold four 16 bit entries, everything else two 32 bit words.
+		uint32_t full = (!ext && !mask) ? 4 : 2;
+		uint32_t slots[4];
+		uint32_t filled = 0;
+
+		for (uint32_t i = first; i <= last && bank < max; i++)
+		{
+			if (i < last)
+			{
+				const Filter_Group_t * group = &groups[i];
+				if ((group->diff != 0) != mask) { continue; }
+
+				if (ext)
+				{
+					slots[filled++] = (group->id << FILTER_EXT32_POS) | FILTER_IDE32;
+					if (mask) { slots[filled++] = ((~group->diff & FILTER_EXT_BITS) << FILTER_EXT32_POS) | FILTER_IDE32; }
+				}
+				else if (mask)
+				{
+					// The ID is in the low half, and its mask in the high half.
+					uint32_t bits = ((~group->diff & FILTER_STD_BITS) << FILTER_STD16_POS) | FILTER_IDE16;
+					slots[filled++] = (group->id << FILTER_STD16_POS) | (bits << 16);
+				}
+				else
+				{
+					slots[filled++] = group->id << FILTER_STD16_POS;
+				}
+			}
+			else
+			{
+				while (filled && filled < full)
+				{
+					slots[filled] = slots[filled - 1];
+					filled += 1;
+				}
+			}
+
+			if (filled == full)
+			{
+				CANBus_Filter_t * b = &banks[bank];
+				b->flags = (ext ? CANBUS_FILTER_32BIT : 0)
+						 | (mask ? 0 : CANBUS_FILTER_LIST)
+						 | ((bank & 1) ? CANBUS_FILTER_FIFO1 : 0);
+				b->fr1 = (full == 4) ? slots[0] | (slots[1] << 16) : slots[0];
+				b->fr2 = (full == 4) ? slots[2] | (slots[3] << 16) : slots[1];
+				bank += 1;
+				filled = 0;
+			}
+		}
+	}
+	return bank;
+}
+
+static uint32_t Filter_Hash(uint32_t id)
+{
+	// Fibonacci hashing spreads the nearby IDs a bus tends to use.
+	return (id * 2654435761u) >> (32 - FILTER_HASH_BITS);
+}
+
+static bool Filter_FindExt(uint32_t id)
+{
+	// The set is never more than half full, so a miss ends quickly on an empty slot.
+	for (uint32_t slot = Filter_Hash(id); ; slot = (slot + 1) & (FILTER_HASH_SIZE - 1))
+	{
+		uint32_t entry = gFilter.ext[slot];
+		if (entry == id) { return true; }
+		if (entry == FILTER_HASH_EMPTY) { return false; }
+	}
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
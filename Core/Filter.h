@@ -0,0 +1,57 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "STM32X.h"
+#include "CAN.h"
+#include "CANBus.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// IDs are grouped in a window of this many. Once it is full, neighbours are
+// merged as further IDs are read in. 14 banks list at most 56 standard IDs.
+#define FILTER_GROUPS_MAX	64
+#define FILTER_EXT_MAX		64
+#define FILTER_BITMAP_SIZE	256 // bytes, one bit per standard ID
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t ids; // Wanted IDs
+	uint32_t matched; // IDs the hardware banks let through, saturating
+	uint32_t seen; // Frames checked in software
+	uint32_t accepted; // Frames that were wanted
+	uint32_t cycles; // CPU cycles spent in the software check
+	uint32_t cycles_max; // Most cycles spent on one frame
+} Filter_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Filter_Init(void);
+
+// Builds up a set of wanted IDs. Returns false once the extended IDs are full.
+void Filter_Clear(void);
+bool Filter_Add(uint32_t id, bool ext);
+// Lets every extended ID through, for when there are too many to list.
+// This lasts until the set is cleared.
+void Filter_PassExt(void);
+// Overwrites part of the standard ID bitmap. Bit n of byte k is ID 8k + n.
+void Filter_SetBitmap(uint32_t offset, const uint8_t * bits, uint32_t size);
+
+// Covers the set with as few unwanted IDs as the hardware banks allow.
+// Anything the banks let through is checked again by Filter_Accept.
+uint32_t Filter_Compile(CANBus_Filter_t * banks, uint32_t max);
+bool Filter_Accept(const CAN_Msg_t * msg);
+
+void Filter_GetStats(Filter_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //FILTER_H
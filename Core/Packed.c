@@ -0,0 +1,233 @@
+#include "Packed.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define PACKED_EXT			(1 << 15)
+#define PACKED_DLC_POS		11
+#define PACKED_ID_BITS		0x1FFFFFFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static uint16_t Packed_ReadHeader(Packed_t * ring);
+static uint32_t Packed_FrameSize(Packed_t * ring, uint16_t header);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Packed_Init(Packed_t * ring, void * buffer, uint32_t size, uint32_t extra)
+{
+	ring->buffer = buffer;
+	ring->mask = size - 1;
+	ring->extra = extra;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->pushed = 0;
+	ring->popped = 0;
+	ring->fill = 0;
+	ring->next = 0;
+}
+
+bool Packed_Push(Packed_t * ring, const CAN_Msg_t * msg, const void * extra)
+{
+	if (!Packed_Reserve(ring, msg->id, msg->ext, msg->len, extra))
+	{
+		return false;
+	}
+
+	uint8_t * buffer = ring->buffer;
+	uint32_t mask = ring->mask;
+	for (uint32_t i = 0; i < msg->len; i++)
+	{
+		buffer[(ring->fill + i) & mask] = msg->data[i];
+	}
+
+	Packed_Commit(ring);
+	return true;
+}
+
+bool Packed_Reserve(Packed_t * ring, uint32_t id, bool ext, uint8_t len, const void * extra)
+{
+	uint32_t head = ring->head;
+	uint32_t size = PACKED_HEADER_SIZE(ext) + ring->extra + len;
+	if (ring->mask + 1 - (head - ring->tail) < size)
+	{
+		return false;
+	}
+
+	uint8_t * buffer = ring->buffer;
+	uint32_t mask = ring->mask;
+
+	uint16_t header = (id & 0x7FF) | (len << PACKED_DLC_POS);
+	if (ext) { header |= PACKED_EXT; }
+	buffer[head++ & mask] = header >> 0;
+	buffer[head++ & mask] = header >> 8;
+
+	if (ext)
+	{
+		buffer[head++ & mask] = id >> 11;
+		buffer[head++ & mask] = id >> 19;
+		buffer[head++ & mask] = id >> 27;
+	}
+
+	const uint8_t * bytes = extra;
+	for (uint32_t i = 0; i < ring->extra; i++)
+	{
+		buffer[head++ & mask] = bytes[i];
+	}
+
+	// Nothing is visible to the consumer until the commit.
+	ring->fill = head;
+	ring->next = head + len;
+	return true;
+}
+
+void Packed_Write(Packed_t * ring, uint32_t index, uint8_t byte)
+{
+	ring->buffer[(ring->fill + index) & ring->mask] = byte;
+}
+
+void Packed_Commit(Packed_t * ring)
+{
+	// The frame must be visible before the consumer can see the new head.
+	__DMB();
+	ring->head = ring->next;
+	ring->pushed += 1;
+}
+
+uint32_t Packed_Free(Packed_t * ring)
+{
+	return (ring->mask + 1 - (ring->head - ring->tail)) / PACKED_FRAME_MAX(ring->extra);
+}
+
+bool Packed_Peek(Packed_t * ring, CAN_Msg_t * msg, void * extra)
+{
+	Packed_Frame_t frame;
+	if (!Packed_PeekFrame(ring, &frame, extra))
+	{
+		return false;
+	}
+
+	const uint8_t * buffer = ring->buffer;
+	uint32_t mask = ring->mask;
+
+	msg->id = frame.id;
+	msg->ext = frame.ext;
+	msg->len = frame.len;
+	for (uint32_t i = 0; i < msg->len; i++)
+	{
+		msg->data[i] = buffer[(frame.data + i) & mask];
+	}
+	return true;
+}
+
+bool Packed_PeekFrame(Packed_t * ring, Packed_Frame_t * frame, void * extra)
+{
+	uint32_t tail = ring->tail;
+	if (tail == ring->head)
+	{
+		return false;
+	}
+
+	// Do not read the frame ahead of the head that published it.
+	__DMB();
+	const uint8_t * buffer = ring->buffer;
+	uint32_t mask = ring->mask;
+
+	uint16_t header = buffer[tail & mask] | (buffer[(tail + 1) & mask] << 8);
+	tail += 2;
+
+	frame->ext = header & PACKED_EXT;
+	frame->len = (header >> PACKED_DLC_POS) & 0x0F;
+	frame->id = header & 0x7FF;
+	if (frame->ext)
+	{
+		frame->id |= ((uint32_t)buffer[(tail + 0) & mask] << 11)
+				   | ((uint32_t)buffer[(tail + 1) & mask] << 19)
+				   | ((uint32_t)buffer[(tail + 2) & mask] << 27);
+		frame->id &= PACKED_ID_BITS;
+		tail += 3;
+	}
+
+	uint8_t * bytes = extra;
+	for (uint32_t i = 0; i < ring->extra; i++)
+	{
+		bytes[i] = buffer[tail++ & mask];
+	}
+
+	frame->data = tail;
+	return true;
+}
+
+uint32_t Packed_ReadWord(Packed_t * ring, const Packed_Frame_t * frame, uint32_t index)
+{
+	const uint8_t * buffer = ring->buffer;
+	uint32_t mask = ring->mask;
+	uint32_t at = frame->data + index;
+	return ((uint32_t)buffer[(at + 0) & mask] <<  0)
+		 | ((uint32_t)buffer[(at + 1) & mask] <<  8)
+		 | ((uint32_t)buffer[(at + 2) & mask] << 16)
+		 | ((uint32_t)buffer[(at + 3) & mask] << 24);
+}
+
+void Packed_Release(Packed_t * ring)
+{
+	uint32_t size = Packed_FrameSize(ring, Packed_ReadHeader(ring));
+
+	// The frame must be read out before the producer may reuse the space.
+	__DMB();
+	ring->tail += size;
+	ring->popped += 1;
+}
+
+bool Packed_Pop(Packed_t * ring, CAN_Msg_t * msg, void * extra)
+{
+	if (!Packed_Peek(ring, msg, extra))
+	{
+		return false;
+	}
+	Packed_Release(ring);
+	return true;
+}
+
+uint32_t Packed_Count(Packed_t * ring)
+{
+	return ring->pushed - ring->popped;
+}
+
+uint32_t Packed_Size(Packed_t * ring)
+{
+	return ring->mask + 1;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static uint16_t Packed_ReadHeader(Packed_t * ring)
+{
+	uint32_t tail = ring->tail;
+	return ring->buffer[tail & ring->mask] | (ring->buffer[(tail + 1) & ring->mask] << 8);
+}
+
+static uint32_t Packed_FrameSize(Packed_t * ring, uint16_t header)
+{
+	return PACKED_HEADER_SIZE(header & PACKED_EXT) + ring->extra + ((header >> PACKED_DLC_POS) & 0x0F);
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
@@ -0,0 +1,84 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// Bytes taken by a frame, not counting the extra bytes
+#define PACKED_HEADER_SIZE(ext)		((ext) ? 5 : 2)
+#define PACKED_FRAME_MAX(extra)		(PACKED_HEADER_SIZE(true) + (extra) + 8)
+
+/*
+ * PUBLIC TYPES
+ */
+
+// A single producer, single consumer ring of CAN frames.
+// Frames are packed as envelope entries: a 16 bit header holding the low 11
+// bits of the ID, the DLC and the extended flag, then 3 more bytes for an
+// extended ID. A fixed number of extra bytes for the owner follow, then only
+// the payload bytes in use. Like Queue_t, each index has a single writer, and
+// the size must be a power of two.
+typedef struct {
+	uint8_t * buffer;
+	uint32_t mask;
+	uint32_t extra;
+	// Free running byte indices
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	// Frames pushed and popped, for the count
+	volatile uint32_t pushed;
+	volatile uint32_t popped;
+	// The frame being filled in place, by the producer
+	uint32_t fill; // Index of its payload
+	uint32_t next; // Head once it is committed
+} Packed_t;
+
+// A frame left in place at the tail, so its payload is read from the ring.
+typedef struct {
+	uint32_t id;
+	bool ext;
+	uint8_t len;
+	uint32_t data; // Index of the payload
+} Packed_Frame_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Packed_Init(Packed_t * ring, void * buffer, uint32_t size, uint32_t extra);
+
+// Producer side
+bool Packed_Push(Packed_t * ring, const CAN_Msg_t * msg, const void * extra);
+// Frames of any shape that are sure to fit
+uint32_t Packed_Free(Packed_t * ring);
+
+// Producer side, in place. The reserve writes the header and extra bytes,
+// the payload is then written a byte at a time, and the commit publishes it.
+// Only one frame may be reserved at once.
+bool Packed_Reserve(Packed_t * ring, uint32_t id, bool ext, uint8_t len, const void * extra);
+void Packed_Write(Packed_t * ring, uint32_t index, uint8_t byte);
+void Packed_Commit(Packed_t * ring);
+
+// Consumer side. The frame is decoded from the ring, so it stays put until released.
+bool Packed_Peek(Packed_t * ring, CAN_Msg_t * msg, void * extra);
+void Packed_Release(Packed_t * ring);
+bool Packed_Pop(Packed_t * ring, CAN_Msg_t * msg, void * extra);
+
+// Consumer side, in place. Only the header and extra bytes are decoded.
+// The payload is read four bytes at a time, little endian. Bytes past the
+// length are undefined.
+bool Packed_PeekFrame(Packed_t * ring, Packed_Frame_t * frame, void * extra);
+uint32_t Packed_ReadWord(Packed_t * ring, const Packed_Frame_t * frame, uint32_t index);
+
+uint32_t Packed_Count(Packed_t * ring);
+uint32_t Packed_Size(Packed_t * ring);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //PACKED_H
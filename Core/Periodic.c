@@ -0,0 +1,162 @@
+#include "Periodic.h"
+#include "TIM.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define PERIODIC_TIMER_FREQ		1000000
+#define PERIODIC_TICK_US		1000
+
+#define PERIODIC_NONE			0xFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	// The payload is double buffered. The host writes the idle copy, then swaps.
+	CAN_Msg_t msg[2];
+	volatile uint8_t active;
+	uint16_t period; // ms, or zero when stopped
+	uint32_t next; // Tick the slot is next due
+	// Free running counts of periods due, and frames sent.
+	// The timer IRQ only writes due, and the refill only writes sent.
+	volatile uint8_t due;
+	uint8_t sent;
+	volatile uint32_t due_time; // Timebase when the slot last fell due
+} Periodic_Slot_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void Periodic_Tick(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	Periodic_Slot_t slots[PERIODIC_SLOTS];
+	volatile uint32_t now; // Ticks since init
+	uint8_t peeked;
+	void (*on_due)(void);
+	Periodic_Stats_t stats;
+} gPeriodic;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Periodic_Init(void (*on_due)(void))
+{
+	gPeriodic.on_due = on_due;
+	gPeriodic.peeked = PERIODIC_NONE;
+
+	TIM_Init(TIM_1, PERIODIC_TIMER_FREQ, PERIODIC_TICK_US - 1);
+	TIM_OnReload(TIM_1, Periodic_Tick);
+	TIM_Start(TIM_1);
+}
+
+void Periodic_Set(uint32_t slot, const CAN_Msg_t * msg, uint16_t period, uint16_t phase)
+{
+	if (slot >= PERIODIC_SLOTS) { return; }
+	Periodic_Slot_t * entry = &gPeriodic.slots[slot];
+
+	// Hold off the timer while the schedule is inconsistent.
+	__disable_irq();
+	entry->period = period;
+	if (period)
+	{
+		// Due next where the tick count matches the phase, modulo the period.
+		uint32_t now = gPeriodic.now + 1;
+		entry->next = now + (phase % period + period - now % period) % period;
+		entry->msg[entry->active] = *msg;
+	}
+	// Anything still due is dropped.
+	entry->sent = entry->due;
+	__enable_irq();
+}
+
+void Periodic_Update(uint32_t slot, const uint8_t * data, uint8_t len)
+{
+	if (slot >= PERIODIC_SLOTS) { return; }
+	Periodic_Slot_t * entry = &gPeriodic.slots[slot];
+
+	// The refill runs in IRQs, and never sees the idle copy half written.
+	uint8_t idle = entry->active ^ 1;
+	entry->msg[idle] = entry->msg[entry->active];
+	entry->msg[idle].len = MIN(len, 8);
+	memcpy(entry->msg[idle].data, data, entry->msg[idle].len);
+	entry->active = idle;
+}
+
+const CAN_Msg_t * Periodic_Peek(void)
+{
+	for (uint32_t i = 0; i < PERIODIC_SLOTS; i++)
+	{
+		Periodic_Slot_t * entry = &gPeriodic.slots[i];
+		uint8_t pending = entry->due - entry->sent;
+		if (pending)
+		{
+			// Only the latest period is worth sending.
+			if (pending > 1)
+			{
+				gPeriodic.stats.missed += pending - 1;
+				entry->sent = entry->due - 1;
+			}
+			gPeriodic.peeked = i;
+			return &entry->msg[entry->active];
+		}
+	}
+	return NULL;
+}
+
+void Periodic_Release(uint32_t now)
+{
+	Periodic_Slot_t * entry = &gPeriodic.slots[gPeriodic.peeked];
+	entry->sent += 1;
+
+	uint32_t latency = now - entry->due_time;
+	gPeriodic.stats.sent += 1;
+	gPeriodic.stats.latency += latency;
+	if (latency > gPeriodic.stats.latency_max) { gPeriodic.stats.latency_max = latency; }
+}
+
+void Periodic_GetStats(Periodic_Stats_t * stats)
+{
+	*stats = gPeriodic.stats;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
+static void Periodic_Tick(void)
+{
+	uint32_t now = gPeriodic.now + 1;
+	gPeriodic.now = now;
+
+	bool due = false;
+	for (uint32_t i = 0; i < PERIODIC_SLOTS; i++)
+	{
+		Periodic_Slot_t * entry = &gPeriodic.slots[i];
+		if (entry->period && entry->next == now)
+		{
+			entry->next += entry->period;
+			entry->due_time = TIM_Read(TIM_2);
+			entry->due += 1;
+			due = true;
+		}
+	}
+
+	if (due && gPeriodic.on_due)
+	{
+		gPeriodic.on_due();
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+#define PERIODIC_SLOTS		16
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t sent;
+	uint32_t missed; // Periods skipped because the last frame had not been sent
+	uint32_t latency; // Total time from due until loaded into a mailbox, in us
+	uint32_t latency_max;
+} Periodic_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Schedules from TIM_1 in millisecond steps. TIM_2 must be running as a
+// microsecond timebase. The callback runs in the timer IRQ when frames fall due.
+void Periodic_Init(void (*on_due)(void));
+
+// A period of zero stops the slot. The phase aligns the slot to a common
+// timeline, so slots keep their offsets from each other.
+void Periodic_Set(uint32_t slot, const CAN_Msg_t * msg, uint16_t period, uint16_t phase);
+// Replaces the payload of a running slot without disturbing its timing.
+void Periodic_Update(uint32_t slot, const uint8_t * data, uint8_t len);
+
+// Consumer side, for the transmit refill
+const CAN_Msg_t * Periodic_Peek(void);
+void Periodic_Release(uint32_t now);
+
+void Periodic_GetStats(Periodic_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //PERIODIC_H
@@ -6,25 +6,118 @@
  */
 
 #define PROTOCOL_CAN_EXT		(1 << 5)
+#define PROTOCOL_CAN_TIME		(1 << 4)
+#define PROTOCOL_CAN_PRIORITY	(1 << 4) // Shares the timestamp bit on transmitted messages
 
-#define PROTOCOL_CAN_ENCODE_MAX		16
+#define PROTOCOL_STREAM_TIMESTAMPS	(1 << 0)
+#define PROTOCOL_STREAM_ENVELOPE	(1 << 1)
+#define PROTOCOL_STREAM_CREDITS		(1 << 2)
+#define PROTOCOL_STREAM_FILTER		(1 << 3)
+#define PROTOCOL_STREAM_ERROR_COUNTS	(1 << 4)
+
+#define PROTOCOL_ENVELOPE_TIMESTAMPS	(1 << 0)
+#define PROTOCOL_ENVELOPE_FILTER	(1 << 1)
+#define PROTOCOL_ENVELOPE_CAPTURE	(1 << 2)
+
+#define PROTOCOL_FORWARD_CHANGE		(1 << 0)
+
+#define PROTOCOL_RATE_CLEAR			(1 << 0)
+#define PROTOCOL_RATE_EXT			(1 << 31)
+#define PROTOCOL_RATE_ID_BITS		0x1FFFFFFF
+
+#define PROTOCOL_PERIODIC_UPDATE	(1 << 0)
+#define PROTOCOL_PERIODIC_EXT		(1 << 31)
+
+#define PROTOCOL_TIMED_EXT			(1 << 31)
+
+#define PROTOCOL_REPLAY_EXT			(1 << 31)
+
+#define PROTOCOL_CAPTURE_QUIET		(1 << 0)
+#define PROTOCOL_CAPTURE_EXT		(1 << 31)
+
+#define PROTOCOL_ENTRY_EXT			(1 << 15)
+#define PROTOCOL_ENTRY_DLC_POS		11
+
+// Sync, header, extended ID, filter index, timestamp, eight data bytes and the end marker
+#define PROTOCOL_CONFIG_TAG_POS		4
+#define PROTOCOL_CONFIG_TAG_BITS	0x07
+
+#define PROTOCOL_CAN_ENCODE_MAX		(1 + 1 + 4 + 1 + 4 + 8 + 1)
 #define PROTOCOL_STATUS_ENCODE_MAX	20
-#define PROTOCOL_ERROR_ENCODE_MAX	4
+#define PROTOCOL_ERROR_ENCODE_MAX	16 // With error counts, otherwise 4
+#define PROTOCOL_LATE_ENCODE_SIZE	11
+#define PROTOCOL_TIME_ENCODE_SIZE	7
+#define PROTOCOL_REPLAY_ENCODE_SIZE	20
+#define PROTOCOL_REPLAY_ENTRY_SIZE	17
+#define PROTOCOL_REPLAY_MAX			8
+#define PROTOCOL_CAPTURE_ENCODE_SIZE	8
+#define PROTOCOL_BUS_ENCODE_SIZE	13
+#define PROTOCOL_CONFIG_ENCODE_SIZE	24
+#define PROTOCOL_STATS_ENCODE_MAX	69
+#define PROTOCOL_STATS_WORDS_MAX	16
+#define PROTOCOL_CREDIT_ENCODE_MAX	7
+#define PROTOCOL_FILTER_ENCODE_SIZE	9
+#define PROTOCOL_ID_LIST_MAX		64
+#define PROTOCOL_RATE_ENCODE_SIZE	12
+#define PROTOCOL_BITMAP_PAGE		64
+
+// Outgoing data is coalesced into full speed bulk packets
+#define PROTOCOL_TX_PACKET_SIZE		64
+#define PROTOCOL_DEFAULT_LATENCY	250 // us
+
+// Envelopes batch several CAN messages under one CRC
+#define PROTOCOL_ENVELOPE_SIZE		(PROTOCOL_TX_PACKET_SIZE * 4)
+#define PROTOCOL_ENVELOPE_HEADER	5
+#define PROTOCOL_ENVELOPE_TRAILER	5
+#define PROTOCOL_ENTRY_ENCODE_MAX	18
+
+// Credits are sent when they change, but no more often than this unless
+// they can share a USB packet with other data.
+#define PROTOCOL_CREDIT_INTERVAL	1000 // us
+
+// Must be a power of two. The longest packet is a full ID list, of 261 bytes,
+// so this takes a full 512 byte USB read on top of any partial packet.
+#define PROTOCOL_RX_SIZE			1024
 
 /*
  * PRIVATE TYPES
  */
 
+typedef struct {
+	uint32_t key; // ID, with the extended flag in the top bit
+	uint16_t every; // Pass only every nth message
+	uint16_t interval; // And no sooner than this after the last, in ms
+	uint16_t held; // Messages dropped since the last passed
+	uint32_t last; // Tick when a message last passed, kept whole so long gaps do not wrap
+	uint32_t dropped;
+	bool passed; // Set once the first message has passed
+} Protocol_RateLimit_t;
+
 /*
  * PRIVATE PROTOTYPES
  */
 
 static uint8_t Protocol_Checksum(const uint8_t * data, uint32_t count);
 static uint32_t Protocol_GetBitrate(uint8_t code);
-static uint32_t Protocol_EncodeCan(const CAN_Msg_t * msg, uint8_t * bfr);
-static uint32_t Protocol_DecodeData(const uint8_t * data, uint32_t size);
-static uint32_t Protocol_EncodeError(Protocol_Error_t error, uint8_t * bfr);
+static uint32_t Protocol_EncodeCan(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t * bfr);
+static uint32_t Protocol_EncodeEntry(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t flags, uint8_t * bfr);
+static void Protocol_EnvelopeAppend(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t flags);
+static void Protocol_EnvelopeFlush(void);
+static uint32_t Protocol_DecodeSize(uint32_t size);
+static void Protocol_DecodeData(uint32_t size);
+static inline uint8_t Protocol_RxByte(uint32_t offset);
+static uint16_t Protocol_RxU16(uint32_t offset);
+static uint32_t Protocol_RxU32(uint32_t offset);
+static uint8_t Protocol_RxChecksum(uint32_t offset, uint32_t count);
+static uint32_t Protocol_EncodeError(Protocol_Error_t error, uint32_t count, uint32_t first, uint32_t last, uint8_t * bfr);
+static uint32_t Protocol_EncodeStats(uint8_t page, uint8_t * bfr);
+static uint8_t * Protocol_EncodeU32(uint8_t * bfr, uint32_t value);
 static void Protocol_ApplyConfig(Protocol_Config_t * config);
+static void Protocol_SetRateLimit(uint32_t id, uint16_t every, uint16_t interval);
+static void Protocol_ReportRateLimits(void);
+static void Protocol_Write(const uint8_t * data, uint32_t len);
+static void Protocol_Flush(void);
+static void Protocol_ReportCredits(bool force);
 
 /*
  * PRIVATE VARIABLES
@@ -33,12 +126,62 @@ static void Protocol_ApplyConfig(Protocol_Config_t * config);
 static Protocol_Callback_t gProtocolCallback;
 
 static struct {
+	// Free running indices into the circular buffer
 	uint32_t head;
-	uint8_t buffer[128];
+	uint32_t tail;
+	// Size of the packet at the tail, once its header has been decoded
+	uint32_t size;
+	uint8_t buffer[PROTOCOL_RX_SIZE];
 } gRx;
 
+static struct {
+	uint32_t head;
+	uint32_t deadline;
+	uint32_t latency;
+	uint8_t buffer[PROTOCOL_TX_PACKET_SIZE];
+} gTx;
+
+static struct {
+	uint32_t head;
+	uint32_t deadline;
+	uint8_t flags; // Fields carried by each entry
+	uint8_t buffer[PROTOCOL_ENVELOPE_SIZE];
+} gEnvelope;
+
+static struct {
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t transfers;
+} gStats;
+
+static struct {
+	uint16_t recieved;
+	uint16_t reported_recieved;
+	uint16_t reported_free;
+	uint32_t reported_time;
+} gCredits;
+
+static struct {
+	Protocol_RateLimit_t entries[PROTOCOL_RATE_LIMITS];
+	uint32_t count;
+	uint32_t passed;
+	uint32_t dropped;
+} gRateLimit;
+
 static bool gProtocol_EnableErrors = false;
 
+// Configs from the compact config message are acknowledged. The Seeed config is not.
+static struct {
+	uint16_t sequence;
+	uint8_t tag; // Chosen by the host, and echoed so it can tell its ack from an older one
+	bool pending;
+} gConfigAck;
+static bool gProtocol_EnableTimestamps = false;
+static bool gProtocol_EnableEnvelope = false;
+static bool gProtocol_EnableCredits = false;
+static bool gProtocol_EnableFilterIndex = false;
+static bool gProtocol_EnableErrorCounts = false;
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -47,57 +190,271 @@ void Protocol_Init(const Protocol_Callback_t * callback)
 {
 	gProtocolCallback = *callback;
 	gRx.head = 0;
+	gRx.tail = 0;
+	gRx.size = 0;
+	gTx.head = 0;
+	gTx.latency = PROTOCOL_DEFAULT_LATENCY;
+	gEnvelope.head = 0;
 }
 
-void Protocol_RecieveCan(const CAN_Msg_t * msg)
+void Protocol_RecieveCan(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter)
 {
-	uint8_t txbfr[PROTOCOL_CAN_ENCODE_MAX];
-	uint32_t txlen = Protocol_EncodeCan(msg, txbfr);
-	gProtocolCallback.tx_data(txbfr, txlen);
+	gStats.frames += 1;
+
+	if (gProtocol_EnableEnvelope)
+	{
+		uint8_t flags = (gProtocol_EnableTimestamps ? PROTOCOL_ENVELOPE_TIMESTAMPS : 0)
+					  | (gProtocol_EnableFilterIndex ? PROTOCOL_ENVELOPE_FILTER : 0);
+		Protocol_EnvelopeAppend(msg, timestamp, filter, flags);
+	}
+	else if (gTx.head + PROTOCOL_CAN_ENCODE_MAX <= sizeof(gTx.buffer))
+	{
+		// Encode straight into the packet when the worst case fits.
+		if (gTx.head == 0)
+		{
+			gTx.deadline = gProtocolCallback.get_time() + gTx.latency;
+		}
+		gTx.head += Protocol_EncodeCan(msg, timestamp, filter, gTx.buffer + gTx.head);
+		if (gTx.head == sizeof(gTx.buffer))
+		{
+			Protocol_Flush();
+		}
+	}
+	else
+	{
+		uint8_t txbfr[PROTOCOL_CAN_ENCODE_MAX];
+		uint32_t txlen = Protocol_EncodeCan(msg, timestamp, filter, txbfr);
+		Protocol_Write(txbfr, txlen);
+	}
+}
+
+bool Protocol_RateLimit(const CAN_Msg_t * msg, uint32_t tick)
+{
+	// The table is small, and a scan is cheaper than hashing.
+	uint32_t key = (msg->id & PROTOCOL_RATE_ID_BITS) | (msg->ext ? PROTOCOL_RATE_EXT : 0);
+	for (uint32_t i = 0; i < gRateLimit.count; i++)
+	{
+		Protocol_RateLimit_t * entry = &gRateLimit.entries[i];
+		if (entry->key != key)
+		{
+			continue;
+		}
+
+		if (entry->passed
+			&& (entry->held + 1 < entry->every || tick - entry->last < entry->interval))
+		{
+			entry->held += 1;
+			entry->dropped += 1;
+			gRateLimit.dropped += 1;
+			return false;
+		}
+
+		entry->passed = true;
+		entry->held = 0;
+		entry->last = tick;
+		break;
+	}
+	gRateLimit.passed += 1;
+	return true;
 }
 
-void Protocol_RecieveError(Protocol_Error_t error)
+void Protocol_RecieveError(Protocol_Error_t error, uint32_t count, uint32_t first, uint32_t last)
 {
 	if (gProtocol_EnableErrors)
 	{
+		// Keep the error in order with any batched messages
+		Protocol_EnvelopeFlush();
+
 		uint8_t txbfr[PROTOCOL_ERROR_ENCODE_MAX];
-		uint32_t txlen = Protocol_EncodeError(error, txbfr);
-		gProtocolCallback.tx_data(txbfr, txlen);
+		uint32_t txlen = Protocol_EncodeError(error, count, first, last, txbfr);
+		Protocol_Write(txbfr, txlen);
+	}
+}
+
+void Protocol_RecieveLate(uint32_t id, bool ext, uint32_t lateness)
+{
+	// Keep the report in order with any batched messages
+	Protocol_EnvelopeFlush();
+
+	uint8_t bfr[PROTOCOL_LATE_ENCODE_SIZE];
+	uint8_t * head = bfr;
+	*head++ = 0xAA;
+	*head++ = 0x23;
+	head = Protocol_EncodeU32(head, id | (ext ? PROTOCOL_TIMED_EXT : 0));
+	head = Protocol_EncodeU32(head, lateness);
+	*head++ = 0x55;
+	Protocol_Write(bfr, head - bfr);
+}
+
+void Protocol_RecieveReplay(const Protocol_Replay_t * replay)
+{
+	uint8_t bfr[PROTOCOL_REPLAY_ENCODE_SIZE];
+	uint8_t * head = bfr;
+	*head++ = 0xAA;
+	*head++ = 0x26;
+	*head++ = replay->state;
+	head = Protocol_EncodeU32(head, replay->played);
+	head = Protocol_EncodeU32(head, replay->underruns);
+	head = Protocol_EncodeU32(head, replay->error);
+	head = Protocol_EncodeU32(head, replay->error_max);
+	*head++ = 0x55;
+
+	// The host is waiting on this to send more, so do not hold it back.
+	Protocol_Write(bfr, head - bfr);
+	Protocol_Flush();
+}
+
+void Protocol_RecieveCapture(uint8_t trigger, uint32_t frames, uint32_t before)
+{
+	// Keep the snapshot apart from any batched messages
+	Protocol_EnvelopeFlush();
+
+	uint8_t bfr[PROTOCOL_CAPTURE_ENCODE_SIZE];
+	uint8_t * head = bfr;
+	*head++ = 0xAA;
+	*head++ = 0x29;
+	*head++ = trigger;
+	*head++ = (frames >> 0);
+	*head++ = (frames >> 8);
+	*head++ = (before >> 0);
+	*head++ = (before >> 8);
+	*head++ = 0x55;
+	Protocol_Write(bfr, head - bfr);
+}
+
+void Protocol_RecieveCaptureFrame(const CAN_Msg_t * msg, uint32_t timestamp)
+{
+	// Snapshots always go in envelopes, so a bulk transfer is checked by its CRC.
+	Protocol_EnvelopeAppend(msg, timestamp, 0, PROTOCOL_ENVELOPE_TIMESTAMPS | PROTOCOL_ENVELOPE_CAPTURE);
+}
+
+void Protocol_RecieveConfig(const Protocol_Config_t * config, uint32_t bitrate, uint16_t sample_point, bool restarted)
+{
+	if (!gConfigAck.pending)
+	{
+		return;
+	}
+	gConfigAck.pending = false;
+
+	// Keep the ack in order with any batched messages
+	Protocol_EnvelopeFlush();
+
+	uint8_t flags = (config->terminator ? 0x01 : 0)
+				  | (config->silent_mode ? 0x02 : 0)
+				  | (config->enable_errors ? 0x04 : 0)
+				  | (config->tx_priority ? 0x08 : 0)
+				  | (gConfigAck.tag << PROTOCOL_CONFIG_TAG_POS)
+				  | (restarted ? 0x80 : 0);
+
+	uint8_t bfr[PROTOCOL_CONFIG_ENCODE_SIZE];
+	uint8_t * head = bfr;
+	*head++ = 0xAA;
+	*head++ = 0x2D;
+	*head++ = (gConfigAck.sequence >> 0);
+	*head++ = (gConfigAck.sequence >> 8);
+	*head++ = flags;
+	head = Protocol_EncodeU32(head, config->bitrate);
+	head = Protocol_EncodeU32(head, bitrate);
+	*head++ = (sample_point >> 0);
+	*head++ = (sample_point >> 8);
+	head = Protocol_EncodeU32(head, config->filter_id);
+	head = Protocol_EncodeU32(head, config->filter_mask);
+	*head++ = 0x55;
+
+	// The host is waiting on this, so do not hold it back.
+	Protocol_Write(bfr, head - bfr);
+	Protocol_Flush();
+}
+
+void Protocol_RecieveBusState(const Protocol_BusState_t * state)
+{
+	// Sent alongside the error messages, when they are enabled.
+	if (gProtocol_EnableErrors)
+	{
+		// Keep the change in order with any batched messages
+		Protocol_EnvelopeFlush();
+
+		uint8_t bfr[PROTOCOL_BUS_ENCODE_SIZE];
+		uint8_t * head = bfr;
+		*head++ = 0xAA;
+		*head++ = 0x2A;
+		*head++ = state->state;
+		*head++ = state->tec;
+		*head++ = state->rec;
+		*head++ = state->last_error;
+		*head++ = (state->bus_offs >> 0);
+		*head++ = (state->bus_offs >> 8);
+		head = Protocol_EncodeU32(head, state->time);
+		*head++ = 0x55;
+		Protocol_Write(bfr, head - bfr);
 	}
 }
 
 void Protocol_Run(void)
 {
-	// Read incoming USB data
-	gRx.head += gProtocolCallback.rx_data(gRx.buffer + gRx.head, sizeof(gRx.buffer) - gRx.head);
-	uint32_t rxtail = 0;
+	// Read incoming USB data into the free space.
+	// This may be split in two where the buffer wraps.
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		uint32_t index = gRx.head & (PROTOCOL_RX_SIZE - 1);
+		uint32_t span = PROTOCOL_RX_SIZE - (gRx.head - gRx.tail);
+		if (span > PROTOCOL_RX_SIZE - index) { span = PROTOCOL_RX_SIZE - index; }
+		if (span == 0) { break; }
+
+		uint32_t read = gProtocolCallback.rx_data(gRx.buffer + index, span);
+		gRx.head += read;
+		if (read < span) { break; }
+	}
 
-	// Try to process messages consecutively from the buffer
-	while (rxtail < gRx.head)
+	// Try to process messages consecutively from the buffer.
+	// The decoder state is kept, so a partial packet is only sized once.
+	while (gRx.head != gRx.tail)
 	{
-		uint32_t processed = Protocol_DecodeData(gRx.buffer + rxtail, gRx.head - rxtail);
-		if (processed == 0)
+		uint32_t available = gRx.head - gRx.tail;
+
+		if (gRx.size == 0)
 		{
-			// Stop if the protocol stops consuming bytes
+			if (Protocol_RxByte(0) != 0xAA)
+			{
+				// Packet does not start with start char.
+				// Start consuming characters to find a start char.
+				gRx.tail += 1;
+				continue;
+			}
+
+			gRx.size = Protocol_DecodeSize(available);
+			if (gRx.size == 0)
+			{
+				// Wait for the rest of the header
+				break;
+			}
+		}
+
+		if (available < gRx.size)
+		{
+			// No bytes consumed. Wait for a full packet
 			break;
 		}
-		rxtail += processed;
+
+		Protocol_DecodeData(gRx.size);
+		gRx.tail += gRx.size;
+		gRx.size = 0;
 	}
 
-	// Now deal with any remaining data.
-	int32_t remaining = gRx.head - rxtail;
-	if (remaining > 0)
+	if (gProtocol_EnableCredits)
 	{
-		// Copy this back to the start of the buffer.
-		for (uint32_t i = 0; i < remaining; i++)
-		{
-			gRx.buffer[i] = gRx.buffer[i + rxtail];
-		}
-		gRx.head = remaining;
+		Protocol_ReportCredits(false);
 	}
-	else
+
+	// Flush any partial packet once it has waited out the latency.
+	if (gEnvelope.head && (int32_t)(gProtocolCallback.get_time() - gEnvelope.deadline) >= 0)
+	{
+		Protocol_EnvelopeFlush();
+		Protocol_Flush();
+	}
+	if (gTx.head && (int32_t)(gProtocolCallback.get_time() - gTx.deadline) >= 0)
 	{
-		gRx.head = 0;
+		Protocol_Flush();
 	}
 }
 
@@ -105,46 +462,274 @@ void Protocol_Run(void)
  * PRIVATE FUNCTIONS
  */
 
+static void Protocol_Write(const uint8_t * data, uint32_t len)
+{
+	while (len)
+	{
+		if (gTx.head == 0)
+		{
+			// The latency deadline starts with the first byte in the packet
+			gTx.deadline = gProtocolCallback.get_time() + gTx.latency;
+		}
+
+		uint32_t count = sizeof(gTx.buffer) - gTx.head;
+		if (count > len) { count = len; }
+
+		memcpy(gTx.buffer + gTx.head, data, count);
+		gTx.head += count;
+		data += count;
+		len -= count;
+
+		if (gTx.head == sizeof(gTx.buffer))
+		{
+			Protocol_Flush();
+		}
+	}
+}
+
+static void Protocol_Flush(void)
+{
+	if (gTx.head)
+	{
+		gProtocolCallback.tx_data(gTx.buffer, gTx.head);
+		gStats.bytes += gTx.head;
+		gStats.transfers += 1;
+		gTx.head = 0;
+	}
+}
+
+static void Protocol_ReportCredits(bool force)
+{
+	// The host can send while the queue is free, less whatever it has sent
+	// since the recieved count we report here.
+	uint16_t free = gProtocolCallback.tx_free();
+	bool changed = free != gCredits.reported_free || gCredits.recieved != gCredits.reported_recieved;
+
+	if (changed || force)
+	{
+		uint32_t now = gProtocolCallback.get_time();
+
+		// Piggyback on pending data, otherwise hold off to limit USB traffic.
+		if (force || gTx.head || (now - gCredits.reported_time) >= PROTOCOL_CREDIT_INTERVAL)
+		{
+			uint8_t bfr[PROTOCOL_CREDIT_ENCODE_MAX];
+			uint8_t * head = bfr;
+			*head++ = 0xAA;
+			*head++ = 0x18;
+			*head++ = (gCredits.recieved >> 0);
+			*head++ = (gCredits.recieved >> 8);
+			*head++ = (free >> 0);
+			*head++ = (free >> 8);
+			*head++ = 0x55;
+			Protocol_Write(bfr, head - bfr);
+
+			gCredits.reported_recieved = gCredits.recieved;
+			gCredits.reported_free = free;
+			gCredits.reported_time = now;
+		}
+	}
+}
+
+static void Protocol_EnvelopeAppend(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t flags)
+{
+	// Every entry in an envelope has the same fields.
+	if (gEnvelope.head + PROTOCOL_ENTRY_ENCODE_MAX + PROTOCOL_ENVELOPE_TRAILER > sizeof(gEnvelope.buffer)
+		|| (gEnvelope.head && gEnvelope.flags != flags))
+	{
+		Protocol_EnvelopeFlush();
+	}
+
+	if (gEnvelope.head == 0)
+	{
+		// Leave room for the header, which is filled on flush.
+		gEnvelope.head = PROTOCOL_ENVELOPE_HEADER;
+		gEnvelope.deadline = gProtocolCallback.get_time() + gTx.latency;
+		gEnvelope.flags = flags;
+	}
+
+	gEnvelope.head += Protocol_EncodeEntry(msg, timestamp, filter, flags, gEnvelope.buffer + gEnvelope.head);
+}
+
+static void Protocol_EnvelopeFlush(void)
+{
+	if (gEnvelope.head)
+	{
+		uint8_t * bfr = gEnvelope.buffer;
+		uint32_t len = gEnvelope.head - PROTOCOL_ENVELOPE_HEADER;
+
+		bfr[0] = 0xAA;
+		bfr[1] = 0x17;
+		bfr[2] = gEnvelope.flags;
+		bfr[3] = (len >> 0);
+		bfr[4] = (len >> 8);
+
+		// The CRC covers the flags, length and entries.
+		uint32_t crc = gProtocolCallback.crc32(bfr + 2, gEnvelope.head - 2);
+		uint8_t * head = Protocol_EncodeU32(bfr + gEnvelope.head, crc);
+		*head++ = 0x55;
+
+		Protocol_Write(bfr, head - bfr);
+		gEnvelope.head = 0;
+	}
+}
+
 void Protocol_ApplyConfig(Protocol_Config_t * config)
 {
 	gProtocol_EnableErrors = config->enable_errors;
 }
 
-static uint32_t Protocol_EncodeError(Protocol_Error_t error, uint8_t * bfr)
+static void Protocol_SetRateLimit(uint32_t id, uint16_t every, uint16_t interval)
+{
+	uint32_t key = (id & PROTOCOL_RATE_ID_BITS) | (id & PROTOCOL_RATE_EXT);
+	uint32_t i = 0;
+	while (i < gRateLimit.count && gRateLimit.entries[i].key != key) { i++; }
+
+	if (every <= 1 && interval == 0)
+	{
+		// An entry that passes everything is removed, and the last moved into its place.
+		if (i < gRateLimit.count)
+		{
+			gRateLimit.count -= 1;
+			gRateLimit.entries[i] = gRateLimit.entries[gRateLimit.count];
+		}
+		return;
+	}
+
+	if (i == gRateLimit.count)
+	{
+		if (gRateLimit.count >= PROTOCOL_RATE_LIMITS) { return; }
+		gRateLimit.count += 1;
+	}
+
+	Protocol_RateLimit_t * entry = &gRateLimit.entries[i];
+	entry->key = key;
+	entry->every = every;
+	entry->interval = interval;
+	entry->held = 0;
+	entry->dropped = 0;
+	entry->passed = false;
+}
+
+static void Protocol_ReportRateLimits(void)
+{
+	uint8_t bfr[4 + PROTOCOL_RATE_LIMITS * PROTOCOL_RATE_ENCODE_SIZE];
+	uint8_t * head = bfr;
+
+	*head++ = 0xAA;
+	*head++ = 0x1F;
+	*head++ = gRateLimit.count;
+	for (uint32_t i = 0; i < gRateLimit.count; i++)
+	{
+		const Protocol_RateLimit_t * entry = &gRateLimit.entries[i];
+		head = Protocol_EncodeU32(head, entry->key);
+		*head++ = (entry->every >> 0);
+		*head++ = (entry->every >> 8);
+		*head++ = (entry->interval >> 0);
+		*head++ = (entry->interval >> 8);
+		head = Protocol_EncodeU32(head, entry->dropped);
+	}
+	*head++ = 0x55;
+
+	Protocol_Write(bfr, head - bfr);
+	Protocol_Flush();
+}
+
+static uint32_t Protocol_EncodeError(Protocol_Error_t error, uint32_t count, uint32_t first, uint32_t last, uint8_t * bfr)
 {
 	uint8_t * head = bfr;
 
 	*head++ = 0xAA;
-	*head++ = 0x15;
-	*head++ = (uint8_t)error;
+	if (gProtocol_EnableErrorCounts)
+	{
+		// The counts only go to hosts that asked for them, as the error message keeps its length.
+		*head++ = 0x2E;
+		*head++ = (uint8_t)error;
+		head = Protocol_EncodeU32(head, count);
+		head = Protocol_EncodeU32(head, first);
+		head = Protocol_EncodeU32(head, last);
+	}
+	else
+	{
+		*head++ = 0x15;
+		*head++ = (uint8_t)error;
+	}
 	*head++ = 0x55;
 
 	return head - bfr;
 }
 
-static uint32_t Protocol_EncodeCan(const CAN_Msg_t * msg, uint8_t * bfr)
+static uint32_t Protocol_EncodeStats(uint8_t page, uint8_t * bfr)
 {
 	uint8_t * head = bfr;
 
 	*head++ = 0xAA;
+	*head++ = 0x19;
+	*head++ = page;
+	uint8_t * len = head++;
 
-	if (msg->ext)
+	switch (page)
 	{
-		*head++ = 0xC0 | PROTOCOL_CAN_EXT | msg->len;
+	case PROTOCOL_STATS_STREAM:
+		head = Protocol_EncodeU32(head, gStats.frames);
+		head = Protocol_EncodeU32(head, gStats.bytes);
+		head = Protocol_EncodeU32(head, gStats.transfers);
+		head = Protocol_EncodeU32(head, gTx.latency);
+		break;
+	case PROTOCOL_STATS_RATE_LIMIT:
+		head = Protocol_EncodeU32(head, gRateLimit.count);
+		head = Protocol_EncodeU32(head, gRateLimit.passed);
+		head = Protocol_EncodeU32(head, gRateLimit.dropped);
+		break;
+	default:
+		{
+			uint32_t words[PROTOCOL_STATS_WORDS_MAX];
+			uint32_t count = gProtocolCallback.get_stats(page, words, LENGTH(words));
+			for (uint32_t i = 0; i < count; i++)
+			{
+				head = Protocol_EncodeU32(head, words[i]);
+			}
+		}
+		break;
+	}
+
+	*len = head - len - 1;
+	*head++ = 0x55;
+
+	return head - bfr;
+}
 
-		*head++ = (msg->id >>  0);
-		*head++ = (msg->id >>  8);
-		*head++ = (msg->id >> 16);
-		*head++ = (msg->id >> 24);
+static uint32_t Protocol_EncodeCan(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t * bfr)
+{
+	uint8_t * head = bfr;
+
+	*head++ = 0xAA;
+
+	uint8_t header = 0xC0 | msg->len;
+	if (gProtocol_EnableTimestamps) { header |= PROTOCOL_CAN_TIME; }
+
+	if (msg->ext)
+	{
+		*head++ = header | PROTOCOL_CAN_EXT;
+		head = Protocol_EncodeU32(head, msg->id);
 	}
 	else
 	{
-		*head++ = 0xC0 | msg->len;
+		*head++ = header;
 
 		*head++ = (msg->id >> 0);
 		*head++ = (msg->id >> 8);
 	}
 
+	if (gProtocol_EnableFilterIndex)
+	{
+		*head++ = filter;
+	}
+
+	if (gProtocol_EnableTimestamps)
+	{
+		head = Protocol_EncodeU32(head, timestamp);
+	}
+
 	for (uint32_t i = 0; i < msg->len; i++)
 	{
 		*head++ = msg->data[i];
@@ -155,6 +740,42 @@ static uint32_t Protocol_EncodeCan(const CAN_Msg_t * msg, uint8_t * bfr)
 	return head - bfr;
 }
 
+static uint32_t Protocol_EncodeEntry(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter, uint8_t flags, uint8_t * bfr)
+{
+	uint8_t * head = bfr;
+
+	// The low 11 bits of the ID share a word with the DLC.
+	uint32_t header = (msg->id & 0x7FF) | (msg->len << PROTOCOL_ENTRY_DLC_POS);
+	if (msg->ext) { header |= PROTOCOL_ENTRY_EXT; }
+
+	*head++ = (header >> 0);
+	*head++ = (header >> 8);
+
+	if (msg->ext)
+	{
+		*head++ = (msg->id >> 11);
+		*head++ = (msg->id >> 19);
+		*head++ = (msg->id >> 27);
+	}
+
+	if (flags & PROTOCOL_ENVELOPE_FILTER)
+	{
+		*head++ = filter;
+	}
+
+	if (flags & PROTOCOL_ENVELOPE_TIMESTAMPS)
+	{
+		head = Protocol_EncodeU32(head, timestamp);
+	}
+
+	for (uint32_t i = 0; i < msg->len; i++)
+	{
+		*head++ = msg->data[i];
+	}
+
+	return head - bfr;
+}
+
 static uint32_t Protocol_EncodeStatus(const Protocol_Status_t * status, uint8_t * bfr)
 {
 	uint8_t * head = bfr;
@@ -164,196 +785,614 @@ static uint32_t Protocol_EncodeStatus(const Protocol_Status_t * status, uint8_t
 	*head++ = 0x04;
 	*head++ = status->rx_errors;
 	*head++ = status->tx_errors;
-
-	for (uint32_t i = 0; i < 14; i++)
-	{
-		*head++ = 0;
-	}
+	*head++ = (status->tx_size >> 0);
+	*head++ = (status->tx_size >> 8);
+	*head++ = (status->tx_queued >> 0);
+	*head++ = (status->tx_queued >> 8);
+	*head++ = (status->tx_free >> 0);
+	*head++ = (status->tx_free >> 8);
+	*head++ = status->bus_state;
+	*head++ = status->tec;
+	*head++ = status->rec;
+	*head++ = status->last_error;
+	*head++ = (status->bus_offs >> 0);
+	*head++ = (status->bus_offs >> 8);
+	*head++ = status->recovery;
+	*head++ = 0;
 
 	*head++ = Protocol_Checksum(&bfr[2], 17);
 
 	return head - bfr;
 }
 
-static uint32_t Protocol_DecodeData(const uint8_t * data, uint32_t size)
+static uint32_t Protocol_DecodeSize(uint32_t size)
 {
-	// This decoder runs optimally when the entire packet arrives at once
-	// For USB traffic this is a normal case.
+	// Works out the size of the packet at the tail from its header.
+	// Returns zero if more bytes are needed to tell.
 
-	if (size < 5)
+	if (size < 2)
 	{
-		// Insufficient for any packet type
 		return 0;
 	}
 
-	if (data[0] != 0xAA)
+	uint8_t header = Protocol_RxByte(1);
+
+	if (header == 0x55)
+	{
+		if (size < 3)
+		{
+			return 0;
+		}
+
+		uint8_t type = Protocol_RxByte(2);
+		if (type == 0x12 || type == 0x04)
+		{
+			//  PACKET TYPE: SEEED STUDIO CONFIG or STATUS
+			return 20;
+		}
+	}
+	else if (header == 0x13)
+	{
+		//  PACKET TYPE: COMPACT CONFIG
+		return 16;
+	}
+	else if (header == 0x16)
+	{
+		//  PACKET TYPE: STREAM CONFIG
+		return 6;
+	}
+	else if (header == 0x19)
+	{
+		//  PACKET TYPE: STATISTICS REQUEST
+		return 4;
+	}
+	else if (header == 0x1A)
+	{
+		if (size < 3)
+		{
+			return 0;
+		}
+
+		//  PACKET TYPE: FILTER BANKS
+		uint32_t count = Protocol_RxByte(2);
+		if (count <= PROTOCOL_FILTER_BANKS)
+		{
+			return 4 + count * PROTOCOL_FILTER_ENCODE_SIZE;
+		}
+	}
+	else if (header == 0x1B)
 	{
-		// Packet does not start with start char.
-		// Start consuming characters to find a start char.
-		for (uint32_t i = 0; i < size; i++)
+		if (size < 4)
+		{
+			return 0;
+		}
+
+		//  PACKET TYPE: ID LIST
+		uint32_t count = Protocol_RxByte(3);
+		if (count <= PROTOCOL_ID_LIST_MAX)
 		{
-			if (data[i] == 0xAA) { return i; }
+			return 5 + count * 4;
+		}
+	}
+	else if (header == 0x1C)
+	{
+		//  PACKET TYPE: ID BITMAP
+		return 5 + PROTOCOL_BITMAP_PAGE;
+	}
+	else if (header == 0x1D)
+	{
+		//  PACKET TYPE: FORWARDING CONFIG
+		return 6;
+	}
+	else if (header == 0x1E)
+	{
+		//  PACKET TYPE: RATE LIMIT
+		return 12;
+	}
+	else if (header == 0x1F)
+	{
+		//  PACKET TYPE: RATE LIMIT REQUEST
+		return 3;
+	}
+	else if (header == 0x20)
+	{
+		//  PACKET TYPE: PERIODIC MESSAGE
+		return 22;
+	}
+	else if (header == 0x21)
+	{
+		//  PACKET TYPE: TIMED CAN MESSAGE
+		return 20;
+	}
+	else if (header == 0x22)
+	{
+		//  PACKET TYPE: TIME REQUEST
+		return 3;
+	}
+	else if (header == 0x24)
+	{
+		if (size < 3)
+		{
+			return 0;
+		}
+
+		//  PACKET TYPE: REPLAY FRAMES
+		uint32_t count = Protocol_RxByte(2);
+		if (count <= PROTOCOL_REPLAY_MAX)
+		{
+			return 4 + count * PROTOCOL_REPLAY_ENTRY_SIZE;
+		}
+	}
+	else if (header == 0x25)
+	{
+		//  PACKET TYPE: REPLAY CONTROL
+		return 4;
+	}
+	else if (header == 0x27)
+	{
+		//  PACKET TYPE: CAPTURE CONFIG
+		return 34;
+	}
+	else if (header == 0x28)
+	{
+		//  PACKET TYPE: CAPTURE TRIGGER
+		return 3;
+	}
+	else if (header == 0x2B)
+	{
+		//  PACKET TYPE: BUS OFF RECOVERY
+		return 6;
+	}
+	else if (header == 0x2C)
+	{
+		//  PACKET TYPE: RECOVER
+		return 3;
+	}
+	else if ((header & 0xC0) == 0xC0)
+	{
+		//  PACKET TYPE: CAN MESSAGE
+		uint32_t len = header & 0x0F;
+		if (len <= 8)
+		{
+			return 3 + ((header & PROTOCOL_CAN_EXT) ? 4 : 2)
+					 + ((header & PROTOCOL_CAN_PRIORITY) ? 1 : 0) + len;
 		}
-		return size;
 	}
 
-	if (data[1] == 0x55)
+	// Header not handled by another case?
+	return 2; // Discard the header.
+}
+
+static void Protocol_DecodeData(uint32_t size)
+{
+	// Handles a complete packet at the tail.
+	// Packets without a valid stop char or checksum are still consumed.
+
+	uint8_t header = Protocol_RxByte(1);
+
+	if (header == 0x55 && size == 20)
 	{
-		if (data[2] == 0x12)
+		if (Protocol_RxByte(size - 1) != Protocol_RxChecksum(2, 17))
+		{
+			return;
+		}
+
+		if (Protocol_RxByte(2) == 0x12)
 		{
 			//
 			//  PACKET TYPE: SEEED STUDIO CONFIG
 			//
-			uint32_t packet_size = 20;
-
-			if (size < packet_size)
-			{
-				// No bytes consumed. Wait for a full packet
-				return 0;
-			}
+			Protocol_Config_t config;
 
-			if (data[packet_size - 1] == Protocol_Checksum(&data[2], 17))
-			{
-				Protocol_Config_t config;
-
-				config.bitrate = Protocol_GetBitrate(data[3]);
-				config.filter_id =		  (data[ 5] <<  0)
-										| (data[ 6] <<  8)
-										| (data[ 7] << 16)
-										| (data[ 8] << 24);
-
-				config.filter_mask = 	  (data[ 9] <<  0)
-									    | (data[10] <<  8)
-									    | (data[11] << 16)
-									    | (data[12] << 24);
-				config.terminator = true;
-				config.enable_errors = false;
-				config.silent_mode = false;
-
-				Protocol_ApplyConfig(&config);
-				gProtocolCallback.configure(&config);
-			}
+			config.bitrate = Protocol_GetBitrate(Protocol_RxByte(3));
+			config.filter_id = Protocol_RxU32(5);
+			config.filter_mask = Protocol_RxU32(9);
+			config.terminator = true;
+			config.enable_errors = false;
+			config.silent_mode = false;
+			config.tx_priority = false;
 
-			return packet_size;
+			Protocol_ApplyConfig(&config);
+			gProtocolCallback.configure(&config);
 		}
-		else if (data[2] == 0x04)
+		else
 		{
 			//
 			//  PACKET TYPE: SEEED STUDIO STATUS
 			//
-			uint32_t packet_size = 20;
-
-			if (size < packet_size)
-			{
-				// No bytes consumed. Wait for a full packet
-				return 0;
-			}
-
-			if (data[packet_size - 1] == Protocol_Checksum(&data[2], 17))
-			{
-				Protocol_Status_t status;
-				gProtocolCallback.get_status(&status);
-				uint8_t bfr[PROTOCOL_STATUS_ENCODE_MAX];
-				uint32_t len = Protocol_EncodeStatus(&status, bfr);
-				gProtocolCallback.tx_data(bfr, len);
-			}
-
-			return packet_size;
+			Protocol_Status_t status;
+			gProtocolCallback.get_status(&status);
+			uint8_t bfr[PROTOCOL_STATUS_ENCODE_MAX];
+			uint32_t len = Protocol_EncodeStatus(&status, bfr);
+			Protocol_Write(bfr, len);
+			Protocol_Flush();
 		}
 	}
-	else if (data[1] == 0x13)
+	else if (header == 0x13 && size == 16)
 	{
 		//
 		//  PACKET TYPE: COMPACT CONFIG
 		//
-		uint32_t packet_size = 16;
-		if (size < packet_size)
-		{
-			// No bytes consumed. Wait for a full packet
-			return 0;
-		}
-
-		if (data[packet_size - 1] == 0x55)
+		if (Protocol_RxByte(size - 1) == 0x55)
 		{
 			Protocol_Config_t config;
 
-			uint8_t flags = 		data[2];
+			uint8_t flags = 		Protocol_RxByte(2);
 			config.terminator = 	flags & 0x01;
 			config.silent_mode = 	flags & 0x02;
 			config.enable_errors = 	flags & 0x04;
+			config.tx_priority = 	flags & 0x08;
 
-			config.bitrate =		  (data[ 3] <<  0)
-									| (data[ 4] <<  8)
-									| (data[ 5] << 16)
-									| (data[ 6] << 24);
-
-			config.filter_id =		  (data[ 7] <<  0)
-									| (data[ 8] <<  8)
-									| (data[ 9] << 16)
-									| (data[10] << 24);
-
-			config.filter_mask = 	  (data[11] <<  0)
-									| (data[12] <<  8)
-									| (data[13] << 16)
-									| (data[14] << 24);
+			config.bitrate = Protocol_RxU32(3);
+			config.filter_id = Protocol_RxU32(7);
+			config.filter_mask = Protocol_RxU32(11);
 
+			// The ack is sent once the controller is running with this config.
+			gConfigAck.sequence += 1;
+			gConfigAck.tag = (flags >> PROTOCOL_CONFIG_TAG_POS) & PROTOCOL_CONFIG_TAG_BITS;
+			gConfigAck.pending = true;
 			Protocol_ApplyConfig(&config);
 			gProtocolCallback.configure(&config);
 		}
-
-		return packet_size;
 	}
-	else if ((data[1] & 0xC0) == 0xC0)
+	else if (header == 0x16 && size == 6)
 	{
 		//
-		//  PACKET TYPE: CAN MESSAGE
+		//  PACKET TYPE: STREAM CONFIG
 		//
-		CAN_Msg_t tx;
-		tx.ext = data[1] & PROTOCOL_CAN_EXT;
-		tx.len = data[1] & 0x0F;
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			// Close any envelope made under the old settings.
+			Protocol_EnvelopeFlush();
 
-		if (tx.len > 8)
+			uint8_t flags = Protocol_RxByte(2);
+			gProtocol_EnableTimestamps = flags & PROTOCOL_STREAM_TIMESTAMPS;
+			gProtocol_EnableEnvelope = flags & PROTOCOL_STREAM_ENVELOPE;
+			gProtocol_EnableCredits = flags & PROTOCOL_STREAM_CREDITS;
+			gProtocol_EnableFilterIndex = flags & PROTOCOL_STREAM_FILTER;
+			gProtocol_EnableErrorCounts = flags & PROTOCOL_STREAM_ERROR_COUNTS;
+
+			gTx.latency = Protocol_RxU16(3);
+
+			if (gProtocol_EnableCredits)
+			{
+				// The host counts its messages from this packet.
+				// Give the host its starting credit straight away.
+				gCredits.recieved = 0;
+				Protocol_ReportCredits(true);
+				Protocol_Flush();
+			}
+		}
+	}
+	else if (header == 0x19 && size == 4)
+	{
+		//
+		//  PACKET TYPE: STATISTICS REQUEST
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
 		{
-			// Not possible
-			return 2;
+			uint8_t bfr[PROTOCOL_STATS_ENCODE_MAX];
+			uint32_t len = Protocol_EncodeStats(Protocol_RxByte(2), bfr);
+			Protocol_Write(bfr, len);
+			Protocol_Flush();
 		}
+	}
+	else if (header == 0x1A)
+	{
+		//
+		//  PACKET TYPE: FILTER BANKS
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			Protocol_Filter_t filters[PROTOCOL_FILTER_BANKS];
+			uint32_t count = Protocol_RxByte(2);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				uint32_t offset = 3 + i * PROTOCOL_FILTER_ENCODE_SIZE;
+				filters[i].flags = Protocol_RxByte(offset);
+				filters[i].fr1 = Protocol_RxU32(offset + 1);
+				filters[i].fr2 = Protocol_RxU32(offset + 5);
+			}
+			gProtocolCallback.set_filters(filters, count);
+		}
+	}
+	else if (header == 0x1B)
+	{
+		//
+		//  PACKET TYPE: ID LIST
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			uint32_t ids[PROTOCOL_ID_LIST_MAX];
+			uint32_t count = Protocol_RxByte(3);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				ids[i] = Protocol_RxU32(4 + i * 4);
+			}
+			gProtocolCallback.set_id_list(ids, count, Protocol_RxByte(2));
+		}
+	}
+	else if (header == 0x1C && size == 5 + PROTOCOL_BITMAP_PAGE)
+	{
+		//
+		//  PACKET TYPE: ID BITMAP
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			uint8_t bits[PROTOCOL_BITMAP_PAGE];
+			for (uint32_t i = 0; i < sizeof(bits); i++)
+			{
+				bits[i] = Protocol_RxByte(4 + i);
+			}
+			uint32_t page = Protocol_RxByte(3);
+			gProtocolCallback.set_id_bitmap(page * sizeof(bits), bits, sizeof(bits), Protocol_RxByte(2));
+		}
+	}
+	else if (header == 0x1D && size == 6)
+	{
+		//
+		//  PACKET TYPE: FORWARDING CONFIG
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			uint8_t flags = Protocol_RxByte(2);
+			gProtocolCallback.set_forwarding(flags & PROTOCOL_FORWARD_CHANGE, Protocol_RxU16(3));
+		}
+	}
+	else if (header == 0x1E && size == 12)
+	{
+		//
+		//  PACKET TYPE: RATE LIMIT
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			if (Protocol_RxByte(2) & PROTOCOL_RATE_CLEAR)
+			{
+				gRateLimit.count = 0;
+			}
+			Protocol_SetRateLimit(Protocol_RxU32(3), Protocol_RxU16(7), Protocol_RxU16(9));
+		}
+	}
+	else if (header == 0x1F && size == 3)
+	{
+		//
+		//  PACKET TYPE: RATE LIMIT REQUEST
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			Protocol_ReportRateLimits();
+		}
+	}
+	else if (header == 0x20 && size == 22)
+	{
+		//
+		//  PACKET TYPE: PERIODIC MESSAGE
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			CAN_Msg_t msg;
+			uint32_t id = Protocol_RxU32(8);
+			msg.ext = id & PROTOCOL_PERIODIC_EXT;
+			msg.id = id & ~PROTOCOL_PERIODIC_EXT;
+			msg.len = MIN(Protocol_RxByte(12), 8);
+			for (uint32_t i = 0; i < sizeof(msg.data); i++)
+			{
+				msg.data[i] = Protocol_RxByte(13 + i);
+			}
 
-		uint32_t packet_size = 3 + (tx.ext ? 4 : 2) + tx.len;
-
-		if (size < packet_size)
+			uint8_t flags = Protocol_RxByte(3);
+			gProtocolCallback.set_periodic(Protocol_RxByte(2), &msg, Protocol_RxU16(4), Protocol_RxU16(6),
+					flags & PROTOCOL_PERIODIC_UPDATE);
+		}
+	}
+	else if (header == 0x21 && size == 20)
+	{
+		//
+		//  PACKET TYPE: TIMED CAN MESSAGE
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
 		{
-			// No bytes consumed. Wait for a full packet
-			return 0;
+			CAN_Msg_t msg;
+			uint32_t id = Protocol_RxU32(6);
+			msg.ext = id & PROTOCOL_TIMED_EXT;
+			msg.id = id & ~PROTOCOL_TIMED_EXT;
+			msg.len = MIN(Protocol_RxByte(10), 8);
+			for (uint32_t i = 0; i < sizeof(msg.data); i++)
+			{
+				msg.data[i] = Protocol_RxByte(11 + i);
+			}
+			gProtocolCallback.tx_timed(&msg, Protocol_RxU32(2));
+		}
+	}
+	else if (header == 0x22 && size == 3)
+	{
+		//
+		//  PACKET TYPE: TIME REQUEST
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			uint8_t bfr[PROTOCOL_TIME_ENCODE_SIZE];
+			uint8_t * head = bfr;
+			*head++ = 0xAA;
+			*head++ = 0x22;
+			head = Protocol_EncodeU32(head, gProtocolCallback.get_time());
+			*head++ = 0x55;
+			Protocol_Write(bfr, head - bfr);
+			Protocol_Flush();
+		}
+	}
+	else if (header == 0x24)
+	{
+		//
+		//  PACKET TYPE: REPLAY FRAMES
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			uint32_t count = Protocol_RxByte(2);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				uint32_t offset = 3 + i * PROTOCOL_REPLAY_ENTRY_SIZE;
+				CAN_Msg_t msg;
+				uint32_t id = Protocol_RxU32(offset + 4);
+				msg.ext = id & PROTOCOL_REPLAY_EXT;
+				msg.id = id & ~PROTOCOL_REPLAY_EXT;
+				msg.len = MIN(Protocol_RxByte(offset + 8), 8);
+				for (uint32_t j = 0; j < sizeof(msg.data); j++)
+				{
+					msg.data[j] = Protocol_RxByte(offset + 9 + j);
+				}
+				gProtocolCallback.replay_push(&msg, Protocol_RxU32(offset));
+			}
+		}
+	}
+	else if (header == 0x25 && size == 4)
+	{
+		//
+		//  PACKET TYPE: REPLAY CONTROL
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			gProtocolCallback.replay_control(Protocol_RxByte(2));
+		}
+	}
+	else if (header == 0x27 && size == 34)
+	{
+		//
+		//  PACKET TYPE: CAPTURE CONFIG
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			Protocol_Capture_t capture;
+			uint8_t flags = Protocol_RxByte(2);
+			capture.quiet = flags & PROTOCOL_CAPTURE_QUIET;
+			capture.trigger = Protocol_RxByte(3);
+			capture.pre = Protocol_RxU16(4);
+			capture.post = Protocol_RxU16(6);
+			uint32_t id = Protocol_RxU32(8);
+			capture.ext = id & PROTOCOL_CAPTURE_EXT;
+			capture.id = id & ~PROTOCOL_CAPTURE_EXT;
+			capture.id_mask = Protocol_RxU32(12);
+			for (uint32_t i = 0; i < sizeof(capture.data); i++)
+			{
+				capture.data[i] = Protocol_RxByte(16 + i);
+				capture.data_mask[i] = Protocol_RxByte(24 + i);
+			}
+			capture.error = Protocol_RxByte(32);
+			gProtocolCallback.set_capture(&capture);
+		}
+	}
+	else if (header == 0x28 && size == 3)
+	{
+		//
+		//  PACKET TYPE: CAPTURE TRIGGER
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			gProtocolCallback.capture_trigger();
+		}
+	}
+	else if (header == 0x2B && size == 6)
+	{
+		//
+		//  PACKET TYPE: BUS OFF RECOVERY
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			gProtocolCallback.set_recovery(Protocol_RxByte(2), Protocol_RxU16(3));
+		}
+	}
+	else if (header == 0x2C && size == 3)
+	{
+		//
+		//  PACKET TYPE: RECOVER
+		//
+		if (Protocol_RxByte(size - 1) == 0x55)
+		{
+			gProtocolCallback.recover();
 		}
+	}
+	else if ((header & 0xC0) == 0xC0 && size > 2)
+	{
+		//
+		//  PACKET TYPE: CAN MESSAGE
+		//
+
+		// Every CAN message counts against the credit, even if malformed.
+		gCredits.recieved += 1;
 
 		// Check for the stop character.
 		// If its not present, the packet is still consumed
-		if (data[packet_size - 1] == 0x55)
+		if (Protocol_RxByte(size - 1) == 0x55)
 		{
-			// Copy the actual fields out.
-			if (tx.ext)
+			bool ext = header & PROTOCOL_CAN_EXT;
+			uint32_t id;
+			uint32_t offset;
+			if (ext)
 			{
-				tx.id = (data[2] <<  0)
-					  | (data[3] <<  8)
-					  | (data[4] << 16)
-					  | (data[5] << 24);
-				memcpy(tx.data, &data[6], tx.len);
+				id = Protocol_RxU32(2);
+				offset = 6;
 			}
 			else
 			{
-				tx.id = (data[2] <<  0)
-					  | (data[3] <<  8);
-				memcpy(tx.data, &data[4], tx.len);
+				id = Protocol_RxU16(2);
+				offset = 4;
 			}
 
-			gProtocolCallback.tx_can(&tx);
-		}
+			// Without a class from the host, the top bits of the ID pick one.
+			uint8_t priority;
+			if (header & PROTOCOL_CAN_PRIORITY)
+			{
+				priority = Protocol_RxByte(offset++);
+				if (priority >= PROTOCOL_TX_CLASSES) { priority = PROTOCOL_TX_CLASSES - 1; }
+			}
+			else
+			{
+				priority = ext ? (id >> 27) & 0x03 : (id >> 9) & 0x03;
+			}
+
+			// The message is decoded straight into the transmit queue.
+			uint8_t len = header & 0x0F;
+			Packed_t * tx = gProtocolCallback.tx_reserve(priority, id, ext, len);
+			if (tx != NULL)
+			{
+				for (uint32_t i = 0; i < len; i++)
+				{
+					Packed_Write(tx, i, Protocol_RxByte(offset + i));
+				}
 
-		return packet_size;
+				gProtocolCallback.tx_commit();
+			}
+		}
 	}
+}
 
-	// Header not handled by another case?
-	return 2; // Discard the header.
+static inline uint8_t Protocol_RxByte(uint32_t offset)
+{
+	return gRx.buffer[(gRx.tail + offset) & (PROTOCOL_RX_SIZE - 1)];
+}
+
+static uint16_t Protocol_RxU16(uint32_t offset)
+{
+	return (Protocol_RxByte(offset + 0) << 0)
+		 | (Protocol_RxByte(offset + 1) << 8);
+}
+
+static uint32_t Protocol_RxU32(uint32_t offset)
+{
+	return (Protocol_RxByte(offset + 0) <<  0)
+		 | (Protocol_RxByte(offset + 1) <<  8)
+		 | (Protocol_RxByte(offset + 2) << 16)
+		 | (Protocol_RxByte(offset + 3) << 24);
+}
+
+static uint8_t Protocol_RxChecksum(uint32_t offset, uint32_t count)
+{
+	uint32_t total = 0;
+	while (count--)
+	{
+		total += Protocol_RxByte(offset++);
+	}
+	return total; // Intentional discarding of high bits.
 }
 
 
@@ -390,6 +1429,15 @@ static uint32_t Protocol_GetBitrate(uint8_t code)
 }
 
 
+static uint8_t * Protocol_EncodeU32(uint8_t * bfr, uint32_t value)
+{
+	*bfr++ = (value >>  0);
+	*bfr++ = (value >>  8);
+	*bfr++ = (value >> 16);
+	*bfr++ = (value >> 24);
+	return bfr;
+}
+
 static uint8_t Protocol_Checksum(const uint8_t * data, uint32_t count)
 {
 	uint32_t total = 0;
@@ -3,11 +3,70 @@
 
 #include "STM32X.h"
 #include "CAN.h" // for message definitions only
+#include "Packed.h"
 
 /*
  * PUBLIC DEFINITIONS
  */
 
+// Transmit priority classes, 0 being the highest
+#define PROTOCOL_TX_CLASSES			4
+
+#define PROTOCOL_FILTER_BANKS		14
+
+// Entries in the recieve rate limit table
+#define PROTOCOL_RATE_LIMITS		16
+
+// Filter bank flags
+#define PROTOCOL_FILTER_32BIT		(1 << 0)
+#define PROTOCOL_FILTER_LIST		(1 << 1)
+#define PROTOCOL_FILTER_FIFO1		(1 << 2)
+
+// ID list flags, and the extended bit on each ID
+#define PROTOCOL_ID_LIST_CLEAR		(1 << 0)
+#define PROTOCOL_ID_LIST_APPLY		(1 << 1)
+#define PROTOCOL_ID_LIST_EXT		(1 << 31)
+
+// Statistics pages. The stream and rate limit pages are filled in by Protocol,
+// the rest are supplied through the get_stats callback.
+#define PROTOCOL_STATS_STREAM		0x00
+#define PROTOCOL_STATS_TX_LATENCY	0x01
+#define PROTOCOL_STATS_RX			0x02
+#define PROTOCOL_STATS_FILTER		0x03
+#define PROTOCOL_STATS_CHANGE		0x04
+#define PROTOCOL_STATS_RATE_LIMIT	0x05
+#define PROTOCOL_STATS_PERIODIC		0x06
+#define PROTOCOL_STATS_TIMED		0x07
+#define PROTOCOL_STATS_REPLAY		0x08
+#define PROTOCOL_STATS_CAPTURE		0x09
+#define PROTOCOL_STATS_ERRORS		0x0A
+#define PROTOCOL_STATS_LOOP			0x0B
+#define PROTOCOL_STATS_CONFIG		0x0C
+
+// Replay commands
+#define PROTOCOL_REPLAY_STOP		0x00
+#define PROTOCOL_REPLAY_START		0x01
+#define PROTOCOL_REPLAY_END			0x02
+
+// Capture triggers
+#define PROTOCOL_CAPTURE_OFF		0x00
+#define PROTOCOL_CAPTURE_FRAME		0x01
+#define PROTOCOL_CAPTURE_ERROR		0x02
+#define PROTOCOL_CAPTURE_BUS_OFF	0x03
+#define PROTOCOL_CAPTURE_MANUAL		0x04
+#define PROTOCOL_CAPTURE_ERROR_ANY	0xFF
+
+// Bus states, as the controller sees its error counters
+#define PROTOCOL_BUS_ACTIVE			0x00
+#define PROTOCOL_BUS_WARNING		0x01
+#define PROTOCOL_BUS_PASSIVE		0x02
+#define PROTOCOL_BUS_OFF			0x03
+
+// Bus off recovery policies
+#define PROTOCOL_RECOVERY_AUTO		0x00
+#define PROTOCOL_RECOVERY_DELAYED	0x01
+#define PROTOCOL_RECOVERY_MANUAL	0x02
+
 /*
  * PUBLIC TYPES
  */
@@ -19,20 +78,90 @@ typedef struct {
 	bool terminator;
 	bool silent_mode;
 	bool enable_errors;
+	bool tx_priority;
 } Protocol_Config_t;
 
+typedef struct {
+	// Filter bank registers, in the bxCAN layout
+	uint32_t fr1;
+	uint32_t fr2;
+	uint8_t flags;
+} Protocol_Filter_t;
+
 typedef struct {
 	uint8_t tx_errors;
 	uint8_t rx_errors;
+	// The transmit queue. Frames are packed, so its capacity depends on their size.
+	uint16_t tx_size; // In bytes
+	uint16_t tx_queued; // Frames waiting
+	uint16_t tx_free; // Frames of any size that are sure to fit
+	// The controller error state
+	uint8_t bus_state;
+	uint8_t tec;
+	uint8_t rec;
+	uint8_t last_error; // A Protocol_Error_t
+	uint16_t bus_offs;
+	uint8_t recovery;
 } Protocol_Status_t;
 
+typedef struct {
+	uint8_t state; // Idle, playing, ending or done
+	uint32_t played;
+	uint32_t underruns;
+	uint32_t error; // Total timing error in us
+	uint32_t error_max;
+} Protocol_Replay_t;
+
+typedef struct {
+	uint8_t trigger;
+	bool quiet; // Hold back the stream while capturing
+	uint16_t pre; // Frames kept from before the trigger
+	uint16_t post; // Frames recorded after it
+	// Frame triggers match the masked bits of the ID and payload
+	uint32_t id;
+	uint32_t id_mask;
+	bool ext;
+	uint8_t data[8];
+	uint8_t data_mask[8];
+	uint8_t error; // A Protocol_Error_t, or PROTOCOL_CAPTURE_ERROR_ANY
+} Protocol_Capture_t;
+
+typedef struct {
+	uint8_t state;
+	uint8_t tec;
+	uint8_t rec;
+	uint8_t last_error; // A Protocol_Error_t
+	uint16_t bus_offs;
+	uint32_t time; // When the state was entered, in us
+} Protocol_BusState_t;
+
 typedef struct {
 	void (*configure)(const Protocol_Config_t * config);
 	void (*get_status)(Protocol_Status_t * status);
-
-	void (*tx_can)(const CAN_Msg_t * msg);
+	void (*set_filters)(const Protocol_Filter_t * filters, uint32_t count);
+	void (*set_id_list)(const uint32_t * ids, uint32_t count, uint8_t flags);
+	void (*set_id_bitmap)(uint32_t offset, const uint8_t * bits, uint32_t size, uint8_t flags);
+	void (*set_forwarding)(bool on_change, uint16_t refresh); // Refresh interval in ms
+	// Period and phase in ms. An update only replaces the payload.
+	void (*set_periodic)(uint8_t slot, const CAN_Msg_t * msg, uint16_t period, uint16_t phase, bool update);
+
+	// Reserves a frame in place in a CAN transmit queue, for the payload to be written
+	// with Packed_Write. NULL when full.
+	Packed_t * (*tx_reserve)(uint8_t priority, uint32_t id, bool ext, uint8_t len);
+	void (*tx_commit)(void);
+	void (*tx_timed)(const CAN_Msg_t * msg, uint32_t release); // Released at a time on the get_time timebase
+	void (*replay_push)(const CAN_Msg_t * msg, uint32_t time); // Time in the trace, in us
+	void (*replay_control)(uint8_t command);
+	void (*set_capture)(const Protocol_Capture_t * capture);
+	void (*capture_trigger)(void);
+	void (*set_recovery)(uint8_t policy, uint16_t delay); // Delay in ms, for the delayed policy
+	void (*recover)(void);
 	void (*tx_data)(const uint8_t * data, uint32_t len);
 	uint32_t (*rx_data)(uint8_t * data, uint32_t max);
+	uint32_t (*get_time)(void); // Free running microsecond timebase
+	uint32_t (*tx_free)(void); // Free slots in the CAN transmit queue
+	uint32_t (*crc32)(const uint8_t * data, uint32_t size);
+	uint32_t (*get_stats)(uint8_t page, uint32_t * words, uint32_t max);
 
 } Protocol_Callback_t;
 
@@ -62,8 +191,24 @@ typedef enum {
 
 void Protocol_Init(const Protocol_Callback_t * callback);
 void Protocol_Run(void);
-void Protocol_RecieveCan(const CAN_Msg_t * msg);
-void Protocol_RecieveError(Protocol_Error_t error);
+void Protocol_RecieveCan(const CAN_Msg_t * msg, uint32_t timestamp, uint8_t filter);
+// False if the message is held back by the rate limit table. The tick is the full millisecond tick.
+bool Protocol_RateLimit(const CAN_Msg_t * msg, uint32_t tick);
+// Reports occurrences of an error since its last report, with the first and last times in us.
+// Unless the host enabled error counts, only the code is sent.
+void Protocol_RecieveError(Protocol_Error_t error, uint32_t count, uint32_t first, uint32_t last);
+// Reports a timed message that left later than its release time.
+void Protocol_RecieveLate(uint32_t id, bool ext, uint32_t lateness);
+// Reports replay progress, or the end of playback.
+void Protocol_RecieveReplay(const Protocol_Replay_t * replay);
+// Starts sending a capture snapshot. The frames follow, in order.
+void Protocol_RecieveCapture(uint8_t trigger, uint32_t frames, uint32_t before);
+void Protocol_RecieveCaptureFrame(const CAN_Msg_t * msg, uint32_t timestamp);
+// Confirms a config from the host, once the controller is running with it.
+// The bitrate is that achieved, and the sample point is in tenths of a percent.
+void Protocol_RecieveConfig(const Protocol_Config_t * config, uint32_t bitrate, uint16_t sample_point, bool restarted);
+// Reports a change of the bus error state.
+void Protocol_RecieveBusState(const Protocol_BusState_t * state);
 
 /*
  * EXTERN DECLARATIONS
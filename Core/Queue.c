@@ -1,5 +1,6 @@
 
 #include "Queue.h"
+#include "STM32X.h"
 #include <string.h>
 
 /*
@@ -24,58 +25,150 @@
 
 void Queue_Init(Queue_t * queue, void * item_bfr, uint32_t item_size, uint32_t item_capacity)
 {
-	queue->count = 0;
-	queue->index = 0;
 	queue->items = item_bfr;
 	queue->item_size = item_size;
-	queue->capacity = item_capacity;
+	queue->mask = item_capacity - 1;
+	queue->head = 0;
+	queue->tail = 0;
 }
 
 bool Queue_Push(Queue_t * queue, const void * item)
 {
-	if (queue->count < queue->capacity)
+	// Aligned word accesses are atomic on the M0. It has no exclusive access
+	// instructions, but none are needed as each index has a single writer.
+	uint32_t head = queue->head;
+	if (head - queue->tail > queue->mask)
 	{
-		uint32_t index = queue->index;
+		return false;
+	}
 
-		memcpy(queue->items + (index * queue->item_size), item, queue->item_size);
+	memcpy(queue->items + ((head & queue->mask) * queue->item_size), item, queue->item_size);
 
-		index += 1;
-		queue->index = index < queue->capacity ? index : 0;
-		queue->count += 1;
-		return true;
-	}
-	return false;
+	// The item must be visible before the consumer can see the new head.
+	__DMB();
+	queue->head = head + 1;
+	return true;
 }
 
 bool Queue_Pop(Queue_t * queue, void * item)
 {
-	if (queue->count > 0)
+	uint32_t tail = queue->tail;
+	if (tail == queue->head)
 	{
-		int32_t index = queue->index - queue->count;
-		if (index < 0) { index += queue->capacity; }
+		return false;
+	}
+
+	// Do not read the item ahead of the head that published it.
+	__DMB();
+	memcpy(item, queue->items + ((tail & queue->mask) * queue->item_size), queue->item_size);
 
-		memcpy(item, queue->items + (index * queue->item_size), queue->item_size);
+	// The item must be read out before the producer may reuse the slot.
+	__DMB();
+	queue->tail = tail + 1;
+	return true;
+}
+
+uint32_t Queue_PushN(Queue_t * queue, const void * items, uint32_t count)
+{
+	uint32_t head = queue->head;
+	uint32_t free = queue->mask + 1 - (head - queue->tail);
+	if (count > free) { count = free; }
+
+	// Copy up to the end of the buffer, then wrap around for the rest.
+	uint32_t index = head & queue->mask;
+	uint32_t first = queue->mask + 1 - index;
+	if (first > count) { first = count; }
+	memcpy(queue->items + (index * queue->item_size), items, first * queue->item_size);
+	memcpy(queue->items, (const uint8_t *)items + (first * queue->item_size), (count - first) * queue->item_size);
+
+	__DMB();
+	queue->head = head + count;
+	return count;
+}
 
-		queue->count -= 1;
-		return true;
+void * Queue_Reserve(Queue_t * queue)
+{
+	// Hands out the next free slot to be filled in place.
+	// Nothing is visible to the consumer until Queue_Commit.
+	uint32_t head = queue->head;
+	if (head - queue->tail > queue->mask)
+	{
+		return NULL;
 	}
-	return false;
+	return queue->items + ((head & queue->mask) * queue->item_size);
+}
+
+void Queue_Commit(Queue_t * queue)
+{
+	__DMB();
+	queue->head += 1;
+}
+
+uint32_t Queue_PopN(Queue_t * queue, void * items, uint32_t count)
+{
+	uint32_t tail = queue->tail;
+	uint32_t available = queue->head - tail;
+	if (count > available) { count = available; }
+
+	__DMB();
+	uint32_t index = tail & queue->mask;
+	uint32_t first = queue->mask + 1 - index;
+	if (first > count) { first = count; }
+	memcpy(items, queue->items + (index * queue->item_size), first * queue->item_size);
+	memcpy((uint8_t *)items + (first * queue->item_size), queue->items, (count - first) * queue->item_size);
+
+	__DMB();
+	queue->tail = tail + count;
+	return count;
+}
+
+void * Queue_Peek(Queue_t * queue)
+{
+	// The oldest item stays in its slot until Queue_Release.
+	uint32_t tail = queue->tail;
+	if (tail == queue->head)
+	{
+		return NULL;
+	}
+	__DMB();
+	return queue->items + ((tail & queue->mask) * queue->item_size);
+}
+
+uint32_t Queue_PeekSpan(Queue_t * queue, void ** items)
+{
+	// Returns the number of items that can be read in one run from *items.
+	// Any items past the end of the buffer are left for the next call.
+	uint32_t tail = queue->tail;
+	uint32_t index = tail & queue->mask;
+	uint32_t count = queue->head - tail;
+	uint32_t span = queue->mask + 1 - index;
+	if (count > span) { count = span; }
+
+	__DMB();
+	*items = queue->items + (index * queue->item_size);
+	return count;
+}
+
+void Queue_Release(Queue_t * queue, uint32_t count)
+{
+	__DMB();
+	queue->tail += count;
 }
 
 void Queue_Clear(Queue_t * queue)
 {
-	queue->count = 0;
-	queue->index = 0;
+	// Discard by consuming everything, so the producer is never disturbed.
+	queue->tail = queue->head;
 }
 
 uint32_t Queue_Free(Queue_t * queue)
 {
-	return queue->capacity - queue->count;
+	return queue->mask + 1 - (queue->head - queue->tail);
 }
 
 uint32_t Queue_Count(Queue_t * queue)
 {
-	return queue->count;
+	return queue->head - queue->tail;
 }
 
 /*
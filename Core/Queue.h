@@ -12,24 +12,38 @@
  * PUBLIC TYPES
  */
 
+// A single producer, single consumer ring.
+// The producer only writes head, and the consumer only writes tail, so one
+// side may run in an IRQ without any locking. The indices are free running
+// and the capacity must be a power of two.
 typedef struct {
-	void * items;
+	uint8_t * items;
 	uint32_t item_size;
-	uint32_t capacity;
-	uint32_t count;
-	uint32_t index;
+	uint32_t mask;
+	volatile uint32_t head;
+	volatile uint32_t tail;
 } Queue_t;
 
 /*
  * PUBLIC FUNCTIONS
  */
 
-
 void Queue_Init(Queue_t * queue, void * buffer, uint32_t item_size, uint32_t item_capacity);
+
+// Producer side
 bool Queue_Push(Queue_t * queue, const void * item);
+uint32_t Queue_PushN(Queue_t * queue, const void * items, uint32_t count);
+void * Queue_Reserve(Queue_t * queue);
+void Queue_Commit(Queue_t * queue);
+uint32_t Queue_Free(Queue_t * queue);
+
+// Consumer side
 bool Queue_Pop(Queue_t * queue, void * item);
+uint32_t Queue_PopN(Queue_t * queue, void * items, uint32_t count);
+void * Queue_Peek(Queue_t * queue);
+uint32_t Queue_PeekSpan(Queue_t * queue, void ** items);
+void Queue_Release(Queue_t * queue, uint32_t count);
 void Queue_Clear(Queue_t * queue);
-uint32_t Queue_Free(Queue_t * queue);
 uint32_t Queue_Count(Queue_t * queue);
 
 /*
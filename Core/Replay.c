@@ -0,0 +1,206 @@
+#include "Replay.h"
+#include "Queue.h"
+#include "TIM.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define REPLAY_CHANNEL		1
+
+/*
+ * PRIVATE TYPES
+ */
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void Replay_Compare(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	Queue_t queue;
+	volatile Replay_State_t state;
+	// Maps trace time onto the timebase. Reset whenever playback starts or recovers from an underrun.
+	uint32_t offset;
+	bool synced;
+	uint32_t reported; // Played count when last polled
+	void (*on_due)(void);
+	Replay_Stats_t stats;
+} gReplay;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Replay_Init(void (*on_due)(void), Replay_Entry_t * buffer)
+{
+	gReplay.on_due = on_due;
+	Queue_Init(&gReplay.queue, buffer, sizeof(*buffer), REPLAY_SIZE);
+	TIM_OnPulse(TIM_2, REPLAY_CHANNEL, Replay_Compare);
+}
+
+bool Replay_IsIdle(void)
+{
+	// A starved playback still expects more frames.
+	return Queue_Count(&gReplay.queue) == 0
+		&& gReplay.state != Replay_State_Playing
+		&& gReplay.state != Replay_State_Ending;
+}
+
+bool Replay_Push(const CAN_Msg_t * msg, uint32_t time)
+{
+	Replay_Entry_t * entry = Queue_Reserve(&gReplay.queue);
+	if (entry == NULL)
+	{
+		return false;
+	}
+	entry->msg = *msg;
+	entry->time = time;
+	Queue_Commit(&gReplay.queue);
+
+	// A starved playback waits for frames rather than the timer.
+	if (gReplay.state == Replay_State_Playing)
+	{
+		gReplay.on_due();
+	}
+	return true;
+}
+
+uint32_t Replay_Free(void)
+{
+	return Queue_Free(&gReplay.queue);
+}
+
+void Replay_Start(void)
+{
+	__disable_irq();
+	memset(&gReplay.stats, 0, sizeof(gReplay.stats));
+	gReplay.reported = 0;
+	gReplay.synced = false;
+	gReplay.state = Replay_State_Playing;
+	__enable_irq();
+	gReplay.on_due();
+}
+
+void Replay_End(void)
+{
+	__disable_irq();
+	if (gReplay.state == Replay_State_Playing)
+	{
+		// An empty buffer is already done.
+		gReplay.state = Queue_Count(&gReplay.queue) ? Replay_State_Ending : Replay_State_Done;
+	}
+	__enable_irq();
+}
+
+void Replay_Stop(void)
+{
+	// The consumer runs in IRQs, so hold them off while emptying its buffer.
+	__disable_irq();
+	Queue_Clear(&gReplay.queue);
+	if (gReplay.state != Replay_State_Idle)
+	{
+		gReplay.state = Replay_State_Done;
+	}
+	__enable_irq();
+}
+
+const CAN_Msg_t * Replay_Peek(uint32_t now)
+{
+	if (gReplay.state != Replay_State_Playing && gReplay.state != Replay_State_Ending)
+	{
+		return NULL;
+	}
+
+	Replay_Entry_t * entry = Queue_Peek(&gReplay.queue);
+	if (entry == NULL)
+	{
+		return NULL;
+	}
+
+	if (!gReplay.synced)
+	{
+		// The first frame goes now, and the rest keep their gaps from it.
+		gReplay.offset = now - entry->time;
+		gReplay.synced = true;
+	}
+
+	uint32_t due = gReplay.offset + entry->time;
+	if ((int32_t)(now - due) < 0)
+	{
+		// The compare only fires on an exact match, so check again once armed.
+		TIM_SetPulse(TIM_2, REPLAY_CHANNEL, due);
+		if ((int32_t)(TIM_Read(TIM_2) - due) < 0)
+		{
+			return NULL;
+		}
+	}
+	return &entry->msg;
+}
+
+void Replay_Release(uint32_t now)
+{
+	Replay_Entry_t * entry = Queue_Peek(&gReplay.queue);
+	uint32_t error = now - (gReplay.offset + entry->time);
+	if ((int32_t)error < 0) { error = 0; }
+
+	gReplay.stats.played += 1;
+	gReplay.stats.error += error;
+	if (error > gReplay.stats.error_max) { gReplay.stats.error_max = error; }
+	Queue_Release(&gReplay.queue, 1);
+
+	if (Queue_Count(&gReplay.queue) == 0)
+	{
+		if (gReplay.state == Replay_State_Ending)
+		{
+			gReplay.state = Replay_State_Done;
+		}
+		else
+		{
+			// The host fell behind. Carry on from the next frame to arrive.
+			gReplay.stats.underruns += 1;
+			gReplay.synced = false;
+		}
+	}
+}
+
+bool Replay_Poll(Replay_Stats_t * stats)
+{
+	Replay_GetStats(stats);
+	bool finished = stats->state == Replay_State_Done;
+	if (!finished && stats->played - gReplay.reported < REPLAY_HALF)
+	{
+		return false;
+	}
+
+	// The IRQs never leave the done state, so it is safe to clear here.
+	if (finished) { gReplay.state = Replay_State_Idle; }
+	gReplay.reported = stats->played;
+	return true;
+}
+
+void Replay_GetStats(Replay_Stats_t * stats)
+{
+	__disable_irq();
+	*stats = gReplay.stats;
+	stats->state = gReplay.state;
+	__enable_irq();
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
+static void Replay_Compare(void)
+{
+	gReplay.on_due();
+}
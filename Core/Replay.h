@@ -0,0 +1,71 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// Must be a power of two. The host refills one half while the other plays.
+#define REPLAY_SIZE			64
+#define REPLAY_HALF			(REPLAY_SIZE / 2)
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef enum {
+	Replay_State_Idle,
+	Replay_State_Playing,
+	Replay_State_Ending, // No more frames are coming
+	Replay_State_Done,
+} Replay_State_t;
+
+// The buffer holds REPLAY_SIZE of these
+typedef struct {
+	CAN_Msg_t msg;
+	uint32_t time;
+} Replay_Entry_t;
+
+typedef struct {
+	Replay_State_t state;
+	uint32_t played;
+	uint32_t underruns; // Times the buffer ran dry mid trace
+	uint32_t error; // Total time frames were loaded after their slot in the trace, in us
+	uint32_t error_max;
+} Replay_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Playback is timed by a compare channel of TIM_2, the microsecond timebase.
+// The callback runs in the timer IRQ once the next frame falls due.
+// The buffer is only used while frames are loaded or playing.
+void Replay_Init(void (*on_due)(void), Replay_Entry_t * buffer);
+bool Replay_IsIdle(void);
+
+// Frames carry their time in the trace, in us. Only the gaps between them matter.
+bool Replay_Push(const CAN_Msg_t * msg, uint32_t time);
+uint32_t Replay_Free(void);
+
+// Frames may be buffered before starting. Ending lets the buffer drain, then stops.
+void Replay_Start(void);
+void Replay_End(void);
+void Replay_Stop(void);
+
+// Consumer side, for the transmit refill
+const CAN_Msg_t * Replay_Peek(uint32_t now);
+void Replay_Release(uint32_t now);
+
+// True when another half of the buffer has played, or playback has finished.
+bool Replay_Poll(Replay_Stats_t * stats);
+void Replay_GetStats(Replay_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //REPLAY_H
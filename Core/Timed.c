@@ -0,0 +1,206 @@
+#include "Timed.h"
+#include "Queue.h"
+#include "TIM.h"
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define TIMED_CHANNEL		0
+
+// Must be a power of two
+#define TIMED_LATE_SIZE		16
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	CAN_Msg_t msg;
+	uint32_t release;
+} Timed_Entry_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static inline bool Timed_Before(const Timed_Entry_t * a, const Timed_Entry_t * b);
+static void Timed_SiftUp(uint32_t index);
+static void Timed_SiftDown(uint32_t index);
+static void Timed_Arm(void);
+static void Timed_Compare(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static struct {
+	// A binary min-heap ordered by release time
+	Timed_Entry_t heap[TIMED_SIZE];
+	uint32_t count;
+	void (*on_due)(void);
+	Queue_t late;
+	Timed_Stats_t stats;
+} gTimed;
+
+static Timed_Late_t gTimedLateBuffer[TIMED_LATE_SIZE];
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+void Timed_Init(void (*on_due)(void))
+{
+	gTimed.on_due = on_due;
+	gTimed.count = 0;
+	Queue_Init(&gTimed.late, gTimedLateBuffer, sizeof(*gTimedLateBuffer), LENGTH(gTimedLateBuffer));
+	TIM_OnPulse(TIM_2, TIMED_CHANNEL, Timed_Compare);
+}
+
+bool Timed_Push(const CAN_Msg_t * msg, uint32_t release)
+{
+	// The heap is popped from IRQs.
+	__disable_irq();
+	bool pushed = gTimed.count < TIMED_SIZE;
+	if (pushed)
+	{
+		gTimed.heap[gTimed.count].msg = *msg;
+		gTimed.heap[gTimed.count].release = release;
+		Timed_SiftUp(gTimed.count++);
+		gTimed.stats.queued += 1;
+		Timed_Arm();
+	}
+	else
+	{
+		gTimed.stats.dropped += 1;
+	}
+	__enable_irq();
+	return pushed;
+}
+
+void Timed_Clear(void)
+{
+	__disable_irq();
+	gTimed.count = 0;
+	__enable_irq();
+}
+
+uint32_t Timed_Free(void)
+{
+	return TIMED_SIZE - gTimed.count;
+}
+
+const CAN_Msg_t * Timed_Peek(uint32_t now)
+{
+	if (gTimed.count && (int32_t)(now - gTimed.heap[0].release) >= 0)
+	{
+		return &gTimed.heap[0].msg;
+	}
+	return NULL;
+}
+
+void Timed_Release(uint32_t now)
+{
+	const Timed_Entry_t * entry = &gTimed.heap[0];
+	uint32_t lateness = now - entry->release;
+
+	gTimed.stats.released += 1;
+	if (lateness > gTimed.stats.lateness_max) { gTimed.stats.lateness_max = lateness; }
+	if (lateness > TIMED_LATE_US)
+	{
+		gTimed.stats.late += 1;
+		Timed_Late_t * late = Queue_Reserve(&gTimed.late);
+		if (late != NULL)
+		{
+			late->id = entry->msg.id;
+			late->ext = entry->msg.ext;
+			late->lateness = lateness;
+			Queue_Commit(&gTimed.late);
+		}
+	}
+
+	// Move the last entry to the root, and let it settle.
+	gTimed.count -= 1;
+	if (gTimed.count)
+	{
+		gTimed.heap[0] = gTimed.heap[gTimed.count];
+		Timed_SiftDown(0);
+		Timed_Arm();
+	}
+}
+
+uint32_t Timed_PeekLate(const Timed_Late_t ** late)
+{
+	return Queue_PeekSpan(&gTimed.late, (void **)late);
+}
+
+void Timed_ReleaseLate(uint32_t count)
+{
+	Queue_Release(&gTimed.late, count);
+}
+
+void Timed_GetStats(Timed_Stats_t * stats)
+{
+	*stats = gTimed.stats;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static inline bool Timed_Before(const Timed_Entry_t * a, const Timed_Entry_t * b)
+{
+	// Compared as a difference, so the timebase may wrap.
+	return (int32_t)(a->release - b->release) < 0;
+}
+
+static void Timed_SiftUp(uint32_t index)
+{
+	Timed_Entry_t entry = gTimed.heap[index];
+	while (index)
+	{
+		uint32_t parent = (index - 1) / 2;
+		if (!Timed_Before(&entry, &gTimed.heap[parent])) { break; }
+		gTimed.heap[index] = gTimed.heap[parent];
+		index = parent;
+	}
+	gTimed.heap[index] = entry;
+}
+
+static void Timed_SiftDown(uint32_t index)
+{
+	Timed_Entry_t entry = gTimed.heap[index];
+	while (true)
+	{
+		uint32_t child = index * 2 + 1;
+		if (child >= gTimed.count) { break; }
+		if (child + 1 < gTimed.count && Timed_Before(&gTimed.heap[child + 1], &gTimed.heap[child])) { child += 1; }
+		if (!Timed_Before(&gTimed.heap[child], &entry)) { break; }
+		gTimed.heap[index] = gTimed.heap[child];
+		index = child;
+	}
+	gTimed.heap[index] = entry;
+}
+
+static void Timed_Arm(void)
+{
+	// The compare only fires on an exact match, so a time already passed is released now.
+	uint32_t release = gTimed.heap[0].release;
+	TIM_SetPulse(TIM_2, TIMED_CHANNEL, release);
+	if ((int32_t)(TIM_Read(TIM_2) - release) >= 0)
+	{
+		gTimed.on_due();
+	}
+}
+
+/*
+ * INTERRUPT ROUTINES
+ */
+
+static void Timed_Compare(void)
+{
+	if (gTimed.count)
+	{
+		gTimed.on_due();
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef TIMED_H
+#define TIMED_H
+
+#include "STM32X.h"
+#include "CAN.h"
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+#define TIMED_SIZE			32
+// Releases later than this are reported
+#define TIMED_LATE_US		20
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t id;
+	bool ext;
+	uint32_t lateness; // us after the release time
+} Timed_Late_t;
+
+typedef struct {
+	uint32_t queued;
+	uint32_t dropped; // Rejected because the heap was full
+	uint32_t released;
+	uint32_t late;
+	uint32_t lateness_max;
+} Timed_Stats_t;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+// Releases are timed by a compare channel of TIM_2, the microsecond timebase.
+// The callback runs in the timer IRQ once the earliest message falls due.
+void Timed_Init(void (*on_due)(void));
+
+// Holds a message until the timebase reaches its release time.
+// Release times more than half the timebase away count as already passed.
+bool Timed_Push(const CAN_Msg_t * msg, uint32_t release);
+void Timed_Clear(void);
+uint32_t Timed_Free(void);
+
+// Consumer side, for the transmit refill
+const CAN_Msg_t * Timed_Peek(uint32_t now);
+void Timed_Release(uint32_t now);
+
+// Late releases, to be read from the main loop. Reports are read in place,
+// a run at a time, and released once sent.
+uint32_t Timed_PeekLate(const Timed_Late_t ** late);
+void Timed_ReleaseLate(uint32_t count);
+
+void Timed_GetStats(Timed_Stats_t * stats);
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+#endif //TIMED_H
@@ -3,9 +3,19 @@
 #include "GPIO.h"
 #include "USB.h"
 #include "CAN.h"
+#include "TIM.h"
 
 #include "Protocol.h"
-#include "Queue.h"
+#include "CANBus.h"
+#include "Checksum.h"
+#include "Filter.h"
+#include "Change.h"
+#include "Periodic.h"
+#include "Timed.h"
+#include "Replay.h"
+#include "Capture.h"
+#include "Packed.h"
+#include "Errors.h"
 #include "Blinker.h"
 #include "MAX3301.h"
 
@@ -14,6 +24,16 @@
  * PRIVATE DEFINITIONS
  */
 
+// Capture snapshot frames sent per pass of the main loop, so the recieve ring keeps draining.
+#define MAIN_CAPTURE_BURST		16
+
+// In bytes, split evenly between the classes in priority mode. Frames are packed
+// with their queueing time, so this holds 170 standard frames of 8 bytes, or 136
+// extended ones. That is twice the RAM of the old 64 frame queue.
+#define MAIN_TX_SIZE			2048
+// Queueing time is kept in 16 bits of 16us, so waits of up to 1s are measured.
+#define MAIN_TX_TIME_SHIFT		4
+
 /*
  * PRIVATE TYPES
  */
@@ -24,28 +44,127 @@
 static void MAIN_InitCAN(const Protocol_Config_t * config);
 
 static void MAIN_ConfigCallback(const Protocol_Config_t * config);
-static void MAIN_TransmitCallback(const CAN_Msg_t * msg);
+static void MAIN_FilterCallback(const Protocol_Filter_t * filters, uint32_t count);
+static void MAIN_ApplyFilters(const Protocol_Config_t * config);
+static void MAIN_AckConfig(bool restarted);
+static void MAIN_IdListCallback(const uint32_t * ids, uint32_t count, uint8_t flags);
+static void MAIN_IdBitmapCallback(uint32_t offset, const uint8_t * bits, uint32_t size, uint8_t flags);
+static void MAIN_ApplyIdList(void);
+static void MAIN_ForwardingCallback(bool on_change, uint16_t refresh);
+static void MAIN_PeriodicCallback(uint8_t slot, const CAN_Msg_t * msg, uint16_t period, uint16_t phase, bool update);
+static Packed_t * MAIN_TransmitReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len);
+static void MAIN_TransmitCommit(void);
+static void MAIN_TransmitTimed(const CAN_Msg_t * msg, uint32_t release);
+static void MAIN_ReplayPush(const CAN_Msg_t * msg, uint32_t time);
+static void MAIN_ReplayControl(uint8_t command);
+static void MAIN_CaptureCallback(const Protocol_Capture_t * capture);
+static void MAIN_CaptureTrigger(void);
+static void MAIN_RecoveryCallback(uint8_t policy, uint16_t delay);
+static void MAIN_RecoverCallback(void);
+static void MAIN_ReportBusState(const CANBus_Status_t * bus, Protocol_BusState_t * state);
+static void MAIN_TransmitRefill(void);
 static void MAIN_StatusCallback(Protocol_Status_t * status);
+static uint32_t MAIN_GetTime(void);
+static uint32_t MAIN_TransmitFree(void);
+static void MAIN_TransmitInitQueues(bool priority);
+static uint32_t MAIN_StatsCallback(uint8_t page, uint32_t * words, uint32_t max);
 
+static uint32_t MAIN_ExtendTimestamp(uint16_t time, uint32_t tick);
 static Protocol_Error_t MAIN_MAX3301FaultToError(MAX3301_Fault_t fault);
+static Protocol_Error_t MAIN_CanErrorToError(CAN_Error_t error);
 
 /*
  * PRIVATE VARIABLES
  */
 
-static Queue_t gCanTxQueue;
-static CAN_Msg_t gCanTxBuffer[64];
+static Packed_t gCanTxQueues[PROTOCOL_TX_CLASSES];
+static uint8_t gCanTxBuffer[MAIN_TX_SIZE];
+static Packed_t * gCanTxReserved; // The queue holding a frame being decoded
+static uint32_t gCanTxClasses = 0;
 static Protocol_Status_t gStatus = {0};
 static Blinker_t gTxBlinker;
 static Blinker_t gRxBlinker;
-static CAN_Error_t gCanError = CAN_Error_None;
+static volatile uint32_t gCanTxCount = 0;
+
+// Filter banks set by the host. Without these, the config filter is used.
+static CANBus_Filter_t gCanFilters[CANBUS_FILTER_BANKS];
+static uint32_t gCanFilterCount = 0;
+// Set when the banks were compiled from an ID list, and need checking in software.
+static bool gCanIdFilter = false;
+// Set when only frames with a changed payload are forwarded.
+static bool gCanForwardOnChange = false;
+// Set when frames are not forwarded while a capture records them.
+static bool gCanCaptureQuiet = false;
+
+// A capture and a replay are never used together, so they share a buffer.
+// Whichever is in use holds it, and the other is refused until it is idle.
+static union {
+	uint8_t capture[CAPTURE_SIZE];
+	Replay_Entry_t replay[REPLAY_SIZE];
+} gCaptureReplayBuffer;
+
+// Bus off recovery. A delayed recovery is started from the main loop.
+static struct {
+	uint8_t policy;
+	uint16_t delay; // ms
+	bool pending;
+	bool apply; // The policy is yet to reach the controller
+	uint32_t tick; // When bus off was entered
+} gCanRecovery = {
+	.policy = PROTOCOL_RECOVERY_AUTO,
+};
+
+// Time from queueing until loaded into a mailbox, by priority class
+static struct {
+	uint32_t frames;
+	uint32_t latency;
+	uint32_t latency_max;
+} gCanTxLatency[PROTOCOL_TX_CLASSES];
+
+// Passes of the main loop, and the longest in us
+static struct {
+	uint32_t passes;
+	uint32_t pass_max;
+} gLoop;
+
+// Time taken applying each config, in us. Frames are lost while the controller restarts.
+static struct {
+	uint32_t count;
+	uint32_t restarts;
+	uint32_t last;
+	uint32_t restart_max;
+	uint32_t update_max; // Applied without a restart
+} gReconfig;
+
+// Tracks the wraps of the 16 bit bxCAN timer
+static struct {
+	uint32_t time;
+	uint32_t tick;
+} gTimestamp;
 
 static const Protocol_Callback_t cProtocolCallbacks = {
 	.tx_data = USB_CDC_Write,
 	.rx_data = USB_CDC_Read,
 	.configure = MAIN_ConfigCallback,
 	.get_status = MAIN_StatusCallback,
-	.tx_can = MAIN_TransmitCallback,
+	.set_filters = MAIN_FilterCallback,
+	.set_id_list = MAIN_IdListCallback,
+	.set_id_bitmap = MAIN_IdBitmapCallback,
+	.set_forwarding = MAIN_ForwardingCallback,
+	.set_periodic = MAIN_PeriodicCallback,
+	.tx_reserve = MAIN_TransmitReserve,
+	.tx_commit = MAIN_TransmitCommit,
+	.tx_timed = MAIN_TransmitTimed,
+	.replay_push = MAIN_ReplayPush,
+	.replay_control = MAIN_ReplayControl,
+	.set_capture = MAIN_CaptureCallback,
+	.capture_trigger = MAIN_CaptureTrigger,
+	.set_recovery = MAIN_RecoveryCallback,
+	.recover = MAIN_RecoverCallback,
+	.get_time = MAIN_GetTime,
+	.tx_free = MAIN_TransmitFree,
+	.crc32 = Checksum_Crc32,
+	.get_stats = MAIN_StatsCallback,
 };
 
 static Protocol_Config_t gDefaultConfig = {
@@ -55,6 +174,7 @@ static Protocol_Config_t gDefaultConfig = {
 	.terminator = false,
 	.silent_mode = false,
 	.enable_errors = false,
+	.tx_priority = false,
 };
 
 
@@ -76,14 +196,25 @@ int main(void)
 	GPIO_EnableInput(VERSION_PIN, GPIO_Pull_Up);
 	bool has_max3301 = !GPIO_Read(VERSION_PIN);
 
+	// Free running microsecond timebase
+	TIM_Init(TIM_2, 1000000, 0xFFFFFFFF);
+	TIM_Start(TIM_2);
+
 	// Init parts & modules.
 	if (has_max3301)
 	{
 		MAX3301_Init();
 	}
 
-	Queue_Init(&gCanTxQueue, gCanTxBuffer, sizeof(*gCanTxBuffer), LENGTH(gCanTxBuffer));
+	Errors_Init();
+	Checksum_Init();
+	Filter_Init();
+	Change_Init();
+	Capture_Init(gCaptureReplayBuffer.capture);
 	MAIN_InitCAN(&gDefaultConfig);
+	Periodic_Init(CANBus_WriteKick);
+	Timed_Init(CANBus_WriteKick);
+	Replay_Init(CANBus_WriteKick, gCaptureReplayBuffer.replay);
 	Protocol_Init(&cProtocolCallbacks);
 	USB_Init();
 
@@ -93,36 +224,160 @@ int main(void)
 
 	while(1)
 	{
+		// Time the longest pass, as anything that blocks here holds up the recieve ring and USB.
+		static uint32_t pass_start = 0;
+		uint32_t now = TIM_Read(TIM_2);
+		if (gLoop.passes++ && now - pass_start > gLoop.pass_max) { gLoop.pass_max = now - pass_start; }
+		pass_start = now;
+
 		// Check for the fault signal from applicable transcievers.
-		if (has_max3301 && MAX3301_IsFaultSet())
+		// MAX3301 signals through the RX & TX lines, so the controller is released
+		// while the fault is read. The loop keeps running meanwhile.
+		if (has_max3301)
+		{
+			MAX3301_Fault_t fault;
+			if (MAX3301_ReadFault(&fault))
+			{
+				Errors_Raise(MAIN_MAX3301FaultToError(fault));
+				MAIN_InitCAN(&gDefaultConfig);
+				// Any config that came in during the read is now running.
+				MAIN_AckConfig(true);
+			}
+			else if (!MAX3301_IsReading() && MAX3301_IsFaultSet())
+			{
+				CAN_Deinit();
+				MAX3301_StartRead();
+			}
+		}
+
+		// A capture triggers on the first error, while the reports are held back.
+		uint32_t raised = Errors_Raised();
+		for (uint32_t code = 0; raised; code++, raised >>= 1)
+		{
+			if (raised & 1) { Capture_Event(Capture_Trigger_Error, code); }
+		}
+
+		// Bursts are reported as a count per code, so they cannot flood the host.
+		Errors_Report_t report;
+		while (Errors_Read(&report))
+		{
+			Protocol_RecieveError(report.code, report.count, report.first, report.last);
+		}
+
+		// Changes of the error state are reported, and the onset of bus off
+		// triggers a capture and any delayed recovery.
+		CANBus_Status_t bus;
+		while (CANBus_ReadStatus(&bus))
 		{
-			// MAX3301 signals through the RX & TX lines
-			CAN_Deinit();
-			MAX3301_Fault_t fault = MAX3301_ClearFault();
-			Protocol_RecieveError(MAIN_MAX3301FaultToError(fault));
-			MAIN_InitCAN(&gDefaultConfig);
+			gCanRecovery.pending = bus.state == CANBus_State_BusOff;
+			if (gCanRecovery.pending)
+			{
+				gCanRecovery.tick = CORE_GetTick();
+				Capture_Event(Capture_Trigger_BusOff, 0);
+			}
+			Protocol_BusState_t state;
+			MAIN_ReportBusState(&bus, &state);
+			Protocol_RecieveBusState(&state);
 		}
 
-		if (gCanError != CAN_Error_None)
+		// Mode changes need the controller, which is released while the MAX3301 is read.
+		// Those that do not take are tried again on the next pass.
+		if (!MAX3301_IsReading())
 		{
-			Protocol_RecieveError(gCanError + Protocol_Error_Stuff - 1);
-			gCanError = CAN_Error_None;
+			if (gCanRecovery.apply)
+			{
+				gCanRecovery.apply = !CANBus_SetAutoRecovery(gCanRecovery.policy == PROTOCOL_RECOVERY_AUTO);
+			}
+
+			// Starting the recovery again would restart its count, so it is only started once.
+			if (gCanRecovery.pending && gCanRecovery.policy == PROTOCOL_RECOVERY_DELAYED
+				&& CORE_GetTick() - gCanRecovery.tick >= gCanRecovery.delay)
+			{
+				gCanRecovery.pending = !CANBus_Recover();
+			}
 		}
 
-		// Read incoming can messages
-		CAN_Msg_t rx;
-		while (CAN_Read(&rx))
+		// Read incoming can messages, buffered by the CAN IRQ
+		CANBus_Frame_t rx;
+		while (CANBus_Read(&rx))
 		{
+			// The banks may let through more than was asked for.
+			if (gCanIdFilter && !Filter_Accept(&rx.msg))
+			{
+				continue;
+			}
+
 			Blinker_Blink(&gRxBlinker, 50);
-			Protocol_RecieveCan(&rx);
+
+			// A capture sees every frame, ahead of the rate limits and change cache.
+			uint32_t timestamp = MAIN_ExtendTimestamp(rx.time, rx.tick);
+			if (Capture_Frame(&rx.msg, timestamp) && gCanCaptureQuiet)
+			{
+				continue;
+			}
+
+			// Rate limits apply first, so the change cache only sees frames that could be sent.
+			// The ring's tick is too coarse for their intervals, so they go by when the frame is read.
+			uint32_t tick = CORE_GetTick();
+			if (!Protocol_RateLimit(&rx.msg, tick))
+			{
+				continue;
+			}
+
+			// Cyclic frames are mostly repeats, and need not all reach the host.
+			if (gCanForwardOnChange && !Change_Forward(&rx.msg, tick))
+			{
+				continue;
+			}
+
+			Protocol_RecieveCan(&rx.msg, timestamp, rx.filter);
+		}
+
+		// Late reports are sent straight from their slots. A run ends at the
+		// end of the buffer, so this takes at most two passes.
+		const Timed_Late_t * late;
+		uint32_t count;
+		while ((count = Timed_PeekLate(&late)) > 0)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				Protocol_RecieveLate(late[i].id, late[i].ext, late[i].lateness);
+			}
+			Timed_ReleaseLate(count);
 		}
 
-		// Write outgoing can messages
-		CAN_Msg_t tx;
-		if (CAN_WriteFree() && Queue_Pop(&gCanTxQueue, &tx))
+		Replay_Stats_t replay;
+		if (Replay_Poll(&replay))
 		{
+			Protocol_Replay_t report = {
+				.state = replay.state,
+				.played = replay.played,
+				.underruns = replay.underruns,
+				.error = replay.error,
+				.error_max = replay.error_max,
+			};
+			Protocol_RecieveReplay(&report);
+		}
+
+		// A finished capture is sent in bursts, after a header giving its size.
+		Capture_Stats_t capture;
+		if (Capture_Poll(&capture))
+		{
+			Protocol_RecieveCapture(capture.trigger, capture.frames, capture.before);
+		}
+		CAN_Msg_t msg;
+		uint32_t timestamp;
+		for (uint32_t i = 0; i < MAIN_CAPTURE_BURST && Capture_Read(&msg, &timestamp); i++)
+		{
+			Protocol_RecieveCaptureFrame(&msg, timestamp);
+		}
+
+		// Outgoing can messages are loaded by MAIN_TransmitRefill
+		static uint32_t tx_count = 0;
+		if (tx_count != gCanTxCount)
+		{
+			tx_count = gCanTxCount;
 			Blinker_Blink(&gTxBlinker, 50);
-			CAN_Write(&tx);
 		}
 
 		Protocol_Run();
@@ -135,41 +390,560 @@ int main(void)
  * PRIVATE FUNCTIONS
  */
 
-static void MAIN_TransmitCallback(const CAN_Msg_t * msg)
+static Packed_t * MAIN_TransmitReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len)
 {
-	if (!Queue_Push(&gCanTxQueue, msg))
+	// Everything shares one queue unless in priority mode.
+	if (priority >= gCanTxClasses) { priority = 0; }
+
+	// The main loop is the only producer, so the reserve needs no lock.
+	// The IRQ only sees the frame once it is committed.
+	uint16_t queued = TIM_Read(TIM_2) >> MAIN_TX_TIME_SHIFT;
+	Packed_t * queue = &gCanTxQueues[priority];
+	if (!Packed_Reserve(queue, id, ext, len, &queued))
 	{
-		Protocol_RecieveError(Protocol_Error_BufferFull);
+		Errors_Raise(Protocol_Error_BufferFull);
 		gStatus.tx_errors += 1;
+		return NULL;
+	}
+	gCanTxReserved = queue;
+	return queue;
+}
+
+static void MAIN_TransmitCommit(void)
+{
+	Packed_Commit(gCanTxReserved);
+
+	// The CAN IRQ is the consumer. Mask it while we consume on its behalf.
+	__disable_irq();
+	MAIN_TransmitRefill();
+	__enable_irq();
+}
+
+static void MAIN_TransmitTimed(const CAN_Msg_t * msg, uint32_t release)
+{
+	if (!Timed_Push(msg, release))
+	{
+		Errors_Raise(Protocol_Error_BufferFull);
+		gStatus.tx_errors += 1;
+	}
+}
+
+static void MAIN_ReplayPush(const CAN_Msg_t * msg, uint32_t time)
+{
+	if (!Capture_IsIdle() || !Replay_Push(msg, time))
+	{
+		Errors_Raise(Protocol_Error_BufferFull);
+		gStatus.tx_errors += 1;
+	}
+}
+
+static void MAIN_ReplayControl(uint8_t command)
+{
+	switch (command)
+	{
+	case PROTOCOL_REPLAY_START:
+		Replay_Start();
+		break;
+	case PROTOCOL_REPLAY_END:
+		Replay_End();
+		break;
+	case PROTOCOL_REPLAY_STOP:
+		Replay_Stop();
+		break;
+	}
+}
+
+static void MAIN_CaptureCallback(const Protocol_Capture_t * capture)
+{
+	if (capture->trigger == PROTOCOL_CAPTURE_OFF)
+	{
+		Capture_Stop();
+		gCanCaptureQuiet = false;
+		return;
+	}
+
+	// The trigger codes align with Capture_Trigger_t
+	Capture_Match_t match = {
+		.trigger = capture->trigger,
+		.id = capture->id,
+		.id_mask = capture->id_mask,
+		.ext = capture->ext,
+		.error = capture->error,
+	};
+	memcpy(match.data, capture->data, sizeof(match.data));
+	memcpy(match.data_mask, capture->data_mask, sizeof(match.data_mask));
+	if (!Replay_IsIdle())
+	{
+		Errors_Raise(Protocol_Error_BufferFull);
+		return;
+	}
+	Capture_Arm(&match, capture->pre, capture->post);
+	gCanCaptureQuiet = capture->quiet;
+}
+
+static void MAIN_CaptureTrigger(void)
+{
+	Capture_Event(Capture_Trigger_Manual, 0);
+}
+
+static void MAIN_RecoveryCallback(uint8_t policy, uint16_t delay)
+{
+	// The controller only recovers by itself under the automatic policy.
+	// The main loop applies this once the controller is free to change.
+	gCanRecovery.policy = policy;
+	gCanRecovery.delay = delay;
+	gCanRecovery.apply = true;
+}
+
+static void MAIN_RecoverCallback(void)
+{
+	CANBus_Status_t bus;
+	CANBus_GetStatus(&bus);
+	// A MAX3301 read ends in a fresh init, which leaves bus off anyway.
+	if (bus.state == CANBus_State_BusOff && !MAX3301_IsReading())
+	{
+		gCanRecovery.pending = !CANBus_Recover();
+	}
+}
+
+static void MAIN_ReportBusState(const CANBus_Status_t * bus, Protocol_BusState_t * state)
+{
+	// The bus states align with CANBus_State_t
+	state->state = bus->state;
+	state->tec = bus->tec;
+	state->rec = bus->rec;
+	state->last_error = MAIN_CanErrorToError(bus->last_error);
+	state->bus_offs = bus->bus_offs;
+	state->time = bus->time;
+}
+
+static void MAIN_TransmitRefill(void)
+{
+	// Keep every mailbox loaded so the bus does not idle between messages.
+	// This runs from the CAN IRQ as each transmit completes.
+	// Classes are served in order, and the mailbox priority sorts out the rest.
+	// Messages are written to the mailbox straight from their queue slot.
+	uint32_t now = TIM_Read(TIM_2);
+
+	// Timed messages go first, as they are the most sensitive to delay.
+	const CAN_Msg_t * timed;
+	while (CANBus_WriteFree() && (timed = Timed_Peek(now)) != NULL)
+	{
+		CANBus_Write(timed);
+		Timed_Release(now);
+		gCanTxCount += 1;
+	}
+
+	// A replay keeps the gaps of its trace, so it goes next.
+	const CAN_Msg_t * replay;
+	while (CANBus_WriteFree() && (replay = Replay_Peek(now)) != NULL)
+	{
+		CANBus_Write(replay);
+		Replay_Release(now);
+		gCanTxCount += 1;
+	}
+
+	// Periodic messages go ahead of the host's queue.
+	const CAN_Msg_t * periodic;
+	while (CANBus_WriteFree() && (periodic = Periodic_Peek()) != NULL)
+	{
+		CANBus_Write(periodic);
+		Periodic_Release(now);
+		gCanTxCount += 1;
+	}
+
+	for (uint32_t i = 0; i < gCanTxClasses; i++)
+	{
+		// Host frames go from their queue slot to the mailbox, and are only released once written.
+		Packed_Frame_t tx;
+		uint16_t queued;
+		while (CANBus_WriteFree() && Packed_PeekFrame(&gCanTxQueues[i], &tx, &queued))
+		{
+			// A class waits rather than let a later message with the same ID overtake.
+			if (gCanTxClasses > 1 && CANBus_WritePending(tx.id, tx.ext))
+			{
+				break;
+			}
+
+			CANBus_WritePacked(&gCanTxQueues[i], &tx);
+
+			uint32_t latency = (uint16_t)((now >> MAIN_TX_TIME_SHIFT) - queued) << MAIN_TX_TIME_SHIFT;
+			gCanTxLatency[i].frames += 1;
+			gCanTxLatency[i].latency += latency;
+			if (latency > gCanTxLatency[i].latency_max) { gCanTxLatency[i].latency_max = latency; }
+
+			Packed_Release(&gCanTxQueues[i]);
+			gCanTxCount += 1;
+		}
+	}
+}
+
+static uint32_t MAIN_TransmitFree(void)
+{
+	// The host does not know which queue a message will land in, or its size.
+	uint32_t free = Packed_Free(&gCanTxQueues[0]);
+	for (uint32_t i = 1; i < gCanTxClasses; i++)
+	{
+		free = MIN(free, Packed_Free(&gCanTxQueues[i]));
+	}
+	return free;
+}
+
+static void MAIN_TransmitInitQueues(bool priority)
+{
+	// In priority mode the buffer is split evenly between the classes.
+	// Anything still queued is dropped.
+	uint32_t classes = priority ? PROTOCOL_TX_CLASSES : 1;
+	uint32_t size = sizeof(gCanTxBuffer) / classes;
+	for (uint32_t i = 0; i < classes; i++)
+	{
+		Packed_Init(&gCanTxQueues[i], gCanTxBuffer + (i * size), size, sizeof(uint16_t));
+	}
+	gCanTxClasses = classes;
+	memset(gCanTxLatency, 0, sizeof(gCanTxLatency));
+}
+
+static uint32_t MAIN_StatsCallback(uint8_t page, uint32_t * words, uint32_t max)
+{
+	uint32_t count = 0;
+	switch (page)
+	{
+	case PROTOCOL_STATS_TX_LATENCY:
+		for (uint32_t i = 0; i < PROTOCOL_TX_CLASSES && count + 3 <= max; i++)
+		{
+			words[count++] = gCanTxLatency[i].frames;
+			words[count++] = gCanTxLatency[i].latency;
+			words[count++] = gCanTxLatency[i].latency_max;
+		}
+		break;
+	case PROTOCOL_STATS_RX:
+		{
+			CANBus_Stats_t stats;
+			CANBus_GetStats(&stats);
+			words[count++] = stats.recieved;
+			words[count++] = stats.dropped;
+			words[count++] = stats.overruns;
+			words[count++] = stats.peak;
+		}
+		break;
+	case PROTOCOL_STATS_FILTER:
+		{
+			Filter_Stats_t stats;
+			Filter_GetStats(&stats);
+			words[count++] = stats.ids;
+			words[count++] = stats.matched;
+			words[count++] = stats.seen;
+			words[count++] = stats.accepted;
+			words[count++] = stats.cycles;
+			words[count++] = stats.cycles_max;
+		}
+		break;
+	case PROTOCOL_STATS_CHANGE:
+		{
+			Change_Stats_t stats;
+			Change_GetStats(&stats);
+			words[count++] = stats.ids;
+			words[count++] = stats.forwarded;
+			words[count++] = stats.suppressed;
+			words[count++] = stats.uncached;
+		}
+		break;
+	case PROTOCOL_STATS_PERIODIC:
+		{
+			Periodic_Stats_t stats;
+			Periodic_GetStats(&stats);
+			words[count++] = stats.sent;
+			words[count++] = stats.missed;
+			words[count++] = stats.latency;
+			words[count++] = stats.latency_max;
+		}
+		break;
+	case PROTOCOL_STATS_TIMED:
+		{
+			Timed_Stats_t stats;
+			Timed_GetStats(&stats);
+			words[count++] = stats.queued;
+			words[count++] = stats.dropped;
+			words[count++] = stats.released;
+			words[count++] = stats.late;
+			words[count++] = stats.lateness_max;
+		}
+		break;
+	case PROTOCOL_STATS_REPLAY:
+		{
+			Replay_Stats_t stats;
+			Replay_GetStats(&stats);
+			words[count++] = stats.state;
+			words[count++] = stats.played;
+			words[count++] = stats.underruns;
+			words[count++] = stats.error;
+			words[count++] = stats.error_max;
+		}
+		break;
+	case PROTOCOL_STATS_CAPTURE:
+		{
+			Capture_Stats_t stats;
+			Capture_GetStats(&stats);
+			words[count++] = stats.state;
+			words[count++] = stats.trigger;
+			words[count++] = stats.frames;
+			words[count++] = stats.before;
+			words[count++] = stats.recorded;
+			words[count++] = stats.overwritten;
+		}
+		break;
+	case PROTOCOL_STATS_LOOP:
+		words[count++] = gLoop.passes;
+		words[count++] = gLoop.pass_max;
+		break;
+	case PROTOCOL_STATS_CONFIG:
+		words[count++] = gReconfig.count;
+		words[count++] = gReconfig.restarts;
+		words[count++] = gReconfig.last;
+		words[count++] = gReconfig.restart_max;
+		words[count++] = gReconfig.update_max;
+		break;
+	case PROTOCOL_STATS_ERRORS:
+		for (uint32_t code = 0; code <= Protocol_Error_RxOverrun && count < max; code++)
+		{
+			words[count++] = Errors_GetTotal(code);
+		}
+		break;
 	}
+	return count;
 }
 
 static void MAIN_ConfigCallback(const Protocol_Config_t * config)
 {
+	// Only the bitrate and mode need the controller restarted, which loses
+	// anything in its mailboxes and FIFOs. The rest is applied while it runs.
+	bool restart = config->bitrate != gDefaultConfig.bitrate
+				|| config->silent_mode != gDefaultConfig.silent_mode
+				|| config->tx_priority != gDefaultConfig.tx_priority;
+	// Filter banks set by the host are kept unless the config's own filter changes.
+	bool refilter = config->filter_id != gDefaultConfig.filter_id
+				 || config->filter_mask != gDefaultConfig.filter_mask;
+
 	// Save the config in case we need to re-init
 	gDefaultConfig = *config;
-	MAIN_InitCAN(config);
+	if (refilter)
+	{
+		gCanFilterCount = 0;
+		gCanIdFilter = false;
+	}
+
+	// The transciever holds the CAN pins while it reports a fault. The
+	// controller is started with this config once it is done.
+	if (MAX3301_IsReading())
+	{
+		return;
+	}
+
+	uint32_t start = TIM_Read(TIM_2);
+	if (restart)
+	{
+		MAIN_InitCAN(config);
+		gReconfig.restarts += 1;
+	}
+	else
+	{
+		if (refilter) { MAIN_ApplyFilters(config); }
+		GPIO_Write(CAN_TERM_PIN, config->terminator);
+	}
+
+	gReconfig.count += 1;
+	gReconfig.last = TIM_Read(TIM_2) - start;
+	if (restart && gReconfig.last > gReconfig.restart_max) { gReconfig.restart_max = gReconfig.last; }
+	if (!restart && gReconfig.last > gReconfig.update_max) { gReconfig.update_max = gReconfig.last; }
+
+	MAIN_AckConfig(restart);
+}
+
+static void MAIN_AckConfig(bool restarted)
+{
+	uint32_t bitrate;
+	uint16_t sample_point;
+	CANBus_GetBitTiming(&bitrate, &sample_point);
+	Protocol_RecieveConfig(&gDefaultConfig, bitrate, sample_point, restarted);
+}
+
+static void MAIN_FilterCallback(const Protocol_Filter_t * filters, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		gCanFilters[i].fr1 = filters[i].fr1;
+		gCanFilters[i].fr2 = filters[i].fr2;
+		gCanFilters[i].flags = ((filters[i].flags & PROTOCOL_FILTER_32BIT) ? CANBUS_FILTER_32BIT : 0)
+							 | ((filters[i].flags & PROTOCOL_FILTER_LIST) ? CANBUS_FILTER_LIST : 0)
+							 | ((filters[i].flags & PROTOCOL_FILTER_FIFO1) ? CANBUS_FILTER_FIFO1 : 0);
+	}
+	gCanFilterCount = count;
+	gCanIdFilter = false;
+
+	// Filters can be changed without stopping the controller.
+	MAIN_ApplyFilters(&gDefaultConfig);
+}
+
+static void MAIN_IdListCallback(const uint32_t * ids, uint32_t count, uint8_t flags)
+{
+	// Lists longer than a packet are sent in parts, and applied with the last.
+	if (flags & PROTOCOL_ID_LIST_CLEAR)
+	{
+		Filter_Clear();
+	}
+	bool full = false;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (!Filter_Add(ids[i] & ~PROTOCOL_ID_LIST_EXT, ids[i] & PROTOCOL_ID_LIST_EXT))
+		{
+			full = true;
+		}
+	}
+	if (full)
+	{
+		// Too many extended IDs to list. Let them all through rather than lose any the host asked for.
+		Errors_Raise(Protocol_Error_BufferFull);
+		Filter_PassExt();
+	}
+
+	if (flags & PROTOCOL_ID_LIST_APPLY)
+	{
+		MAIN_ApplyIdList();
+	}
+}
+
+static void MAIN_IdBitmapCallback(uint32_t offset, const uint8_t * bits, uint32_t size, uint8_t flags)
+{
+	if (flags & PROTOCOL_ID_LIST_CLEAR)
+	{
+		Filter_Clear();
+	}
+	Filter_SetBitmap(offset, bits, size);
+
+	if (flags & PROTOCOL_ID_LIST_APPLY)
+	{
+		MAIN_ApplyIdList();
+	}
+}
+
+static void MAIN_ApplyIdList(void)
+{
+	// An empty list compiles to no banks, which returns to the config filter.
+	gCanFilterCount = Filter_Compile(gCanFilters, LENGTH(gCanFilters));
+	gCanIdFilter = gCanFilterCount > 0;
+	MAIN_ApplyFilters(&gDefaultConfig);
+}
+
+static void MAIN_ForwardingCallback(bool on_change, uint16_t refresh)
+{
+	// Start from an empty table, so every ID is sent once.
+	Change_Clear(refresh);
+	gCanForwardOnChange = on_change;
+}
+
+static void MAIN_PeriodicCallback(uint8_t slot, const CAN_Msg_t * msg, uint16_t period, uint16_t phase, bool update)
+{
+	if (update)
+	{
+		Periodic_Update(slot, msg->data, msg->len);
+	}
+	else
+	{
+		Periodic_Set(slot, msg, period, phase);
+	}
+}
+
+static void MAIN_ApplyFilters(const Protocol_Config_t * config)
+{
+	// An empty list of banks returns to the filter in the config.
+	if (gCanFilterCount)
+	{
+		CANBus_SetFilters(gCanFilters, gCanFilterCount);
+	}
+	else
+	{
+		CAN_EnableFilter(0, config->filter_id, config->filter_mask);
+		CANBus_SpreadFilter();
+	}
 }
 
 static void MAIN_CanErrorCallback(CAN_Error_t error)
 {
-	gCanError = error;
+	Errors_Raise(MAIN_CanErrorToError(error));
 }
 
 static void MAIN_InitCAN(const Protocol_Config_t * config)
 {
 	// Running the mailbox in FIFO guarantees message TX order.
-	CAN_Mode_t mode = CAN_Mode_TransmitFIFO;
+	// Otherwise the mailbox with the lowest ID is sent first.
+	CAN_Mode_t mode = config->tx_priority ? CAN_Mode_Default : CAN_Mode_TransmitFIFO;
 	if (config->silent_mode) { mode |= CAN_Mode_Silent; }
 	CAN_Init(config->bitrate, mode);
-	CAN_EnableFilter(0, config->filter_id, config->filter_mask);
+	if (!CANBus_Init())
+	{
+		// Without time triggered mode, the recieve timestamps are not captured.
+		Errors_Raise(Protocol_Error_Software);
+	}
+	MAIN_ApplyFilters(config);
 	GPIO_Write(CAN_TERM_PIN, config->terminator);
-	CAN_OnError(MAIN_CanErrorCallback);
+	CANBus_OnError(MAIN_CanErrorCallback);
+	CANBus_OnTransmit(MAIN_TransmitRefill);
+
+	// Anything still queued must be reloaded into the fresh mailboxes.
+	__disable_irq();
+	if (gCanTxClasses != (config->tx_priority ? PROTOCOL_TX_CLASSES : 1))
+	{
+		MAIN_TransmitInitQueues(config->tx_priority);
+	}
+	MAIN_TransmitRefill();
+	__enable_irq();
+
+	// The bit timer restarts with the controller
+	gTimestamp.time = 0;
+	gTimestamp.tick = CORE_GetTick();
+}
+
+static uint32_t MAIN_ExtendTimestamp(uint16_t time, uint32_t tick)
+{
+	// The bit timer wraps every 65536 bit times, which is only 65ms at 1Mbit/s.
+	// Use the millisecond tick to estimate how far the timer has run since the
+	// last timestamp, then pick the wrap count that lands nearest that estimate.
+	// The frame may have waited in the recieve ring, so work from its own tick.
+	// That is only good to 16ms, well inside the half wrap the estimate may be out by.
+	uint32_t elapsed = tick - gTimestamp.tick;
+	uint32_t expected = gTimestamp.time + elapsed * (gDefaultConfig.bitrate / 1000);
+
+	gTimestamp.time = expected + (int16_t)(time - (uint16_t)expected);
+	gTimestamp.tick = tick;
+	return gTimestamp.time;
 }
 
 static void MAIN_StatusCallback(Protocol_Status_t * status)
 {
 	*status = gStatus;
+	status->tx_size = sizeof(gCanTxBuffer);
+	status->tx_queued = 0;
+	for (uint32_t i = 0; i < gCanTxClasses; i++)
+	{
+		status->tx_queued += Packed_Count(&gCanTxQueues[i]);
+	}
+	status->tx_free = MAIN_TransmitFree();
+
+	CANBus_Status_t bus;
+	CANBus_GetStatus(&bus);
+	Protocol_BusState_t state;
+	MAIN_ReportBusState(&bus, &state);
+	status->bus_state = state.state;
+	status->tec = state.tec;
+	status->rec = state.rec;
+	status->last_error = state.last_error;
+	status->bus_offs = state.bus_offs;
+	status->recovery = gCanRecovery.policy;
+}
+
+static uint32_t MAIN_GetTime(void)
+{
+	return TIM_Read(TIM_2);
 }
 
 static Protocol_Error_t MAIN_MAX3301FaultToError(MAX3301_Fault_t fault)
@@ -188,3 +962,9 @@ static Protocol_Error_t MAIN_MAX3301FaultToError(MAX3301_Fault_t fault)
 	}
 }
 
+static Protocol_Error_t MAIN_CanErrorToError(CAN_Error_t error)
+{
+	// Note, the CAN errors align with Protocol_Error_t, past the transciever faults.
+	return error == CAN_Error_None ? Protocol_Error_Unknown : error + Protocol_Error_Stuff - 1;
+}
+
@@ -1,7 +1,7 @@
 
 #include "MAX3301.h"
 #include "GPIO.h"
-#include "US.h"
+#include "TIM.h"
 
 /*
  * PRIVATE DEFINITIONS
@@ -11,22 +11,45 @@
 #define MAX3301_CODE_OVERVOLTAGE	0x2C
 #define MAX3301_CODE_TXFAILURE		0x32
 
+// Sequence is:
+//    10 bit start sequence
+//    6 bit fault code
+//    10 bit clear sequence
+#define MAX3301_SYNC_BITS			11
+#define MAX3301_CODE_BITS			5
+#define MAX3301_CLEAR_BITS			10
+
 /*
  * PRIVATE TYPES
  */
 
+typedef enum {
+	MAX3301_State_Idle,
+	MAX3301_State_Sync,
+	MAX3301_State_Code,
+	MAX3301_State_Clear,
+	MAX3301_State_Done,
+} MAX3301_State_t;
+
 /*
  * PRIVATE PROTOTYPES
  */
 
-static bool MAX3301_ReadSync(uint32_t count);
-static uint32_t MAX3301_ReadBits(uint32_t count);
+static void MAX3301_Clock(void);
+static void MAX3301_ShiftBit(bool bit);
 static MAX3301_Fault_t MAX3301_DecodeFaultCode(uint32_t code);
 
 /*
  * PRIVATE VARIABLES
  */
 
+static struct {
+	volatile MAX3301_State_t state;
+	bool high; // The clock is high, and the next edge samples a bit
+	uint32_t bits; // Bits left in this part of the sequence
+	uint32_t code;
+} gMAX3301;
+
 /*
  * PUBLIC FUNCTIONS
  */
@@ -34,6 +57,8 @@ static MAX3301_Fault_t MAX3301_DecodeFaultCode(uint32_t code);
 void MAX3301_Init(void)
 {
 	GPIO_EnableInput(MAX3301_FAULT_PIN, GPIO_Pull_Up);
+	gMAX3301.state = MAX3301_State_Idle;
+	TIM_OnPulse(MAX3301_TIM, MAX3301_TIM_CHANNEL, MAX3301_Clock);
 }
 
 void MAX3301_Deinit(void)
@@ -46,63 +71,74 @@ bool MAX3301_IsFaultSet(void)
 	return GPIO_Read(MAX3301_FAULT_PIN);
 }
 
-MAX3301_Fault_t MAX3301_ClearFault(void)
+void MAX3301_StartRead(void)
 {
 	GPIO_EnableOutput(MAX3301_CANTX_PIN, GPIO_PIN_RESET);
 	GPIO_EnableInput(MAX3301_CANRX_PIN, GPIO_Pull_None);
 
-	// Sequence is:
-	//    10 bit start sequence
-	//    6 bit fault code
-	//    10 bit clear sequence
+	// We do not know how far into the start sequence we are.
+	// The top bit of the code is always set - so we can read until we hit this.
+	gMAX3301.high = false;
+	gMAX3301.bits = MAX3301_SYNC_BITS;
+	gMAX3301.code = 0;
+	gMAX3301.state = MAX3301_State_Sync;
+	TIM_SetPulse(MAX3301_TIM, MAX3301_TIM_CHANNEL, TIM_Read(MAX3301_TIM) + MAX3301_HALF_BIT_US);
+}
 
-	// However - we do not know how far into the start sequence we are
-	// The top bit is always set - so we can read until we hit this.
-	MAX3301_ReadSync(11);
-	// Assume the top bit was successfully read.
-	uint32_t code = MAX3301_ReadBits(5) | (1 << 5);
-	// Discard the remaining bits.
-	MAX3301_ReadBits(10);
+bool MAX3301_IsReading(void)
+{
+	return gMAX3301.state != MAX3301_State_Idle;
+}
+
+bool MAX3301_ReadFault(MAX3301_Fault_t * fault)
+{
+	if (gMAX3301.state != MAX3301_State_Done)
+	{
+		return false;
+	}
 
 	GPIO_Deinit(MAX3301_CANTX_PIN | MAX3301_CANRX_PIN);
+	gMAX3301.state = MAX3301_State_Idle;
 
-	return MAX3301_DecodeFaultCode(code);
+	// Assume the top bit was successfully read.
+	*fault = MAX3301_DecodeFaultCode(gMAX3301.code | (1 << MAX3301_CODE_BITS));
+	return true;
 }
 
 /*
  * PRIVATE FUNCTIONS
  */
 
-static bool MAX3301_ReadSync(uint32_t count)
+static void MAX3301_ShiftBit(bool bit)
 {
-	// Read until we find a high bit.
-	while (count--)
+	switch (gMAX3301.state)
 	{
-		US_Delay(1);
-		GPIO_Set(MAX3301_CANTX_PIN);
-		US_Delay(1);
-		bool bit = GPIO_Read(MAX3301_CANRX_PIN);
-		GPIO_Reset(MAX3301_CANTX_PIN);
-
-		if (bit) { return true; }
-	}
-	return false;
-}
-
-static uint32_t MAX3301_ReadBits(uint32_t count)
-{
-	// Read the specified number of bits.
-	uint32_t value = 0;
-	while (count--)
-	{
-		US_Delay(1);
-		GPIO_Set(MAX3301_CANTX_PIN);
-		US_Delay(1);
-		value <<= 1;
-		value |= GPIO_Read(MAX3301_CANRX_PIN) ? 1 : 0;
-		GPIO_Reset(MAX3301_CANTX_PIN);
+	case MAX3301_State_Sync:
+		// Read until we find a high bit.
+		if (bit || --gMAX3301.bits == 0)
+		{
+			gMAX3301.bits = MAX3301_CODE_BITS;
+			gMAX3301.state = MAX3301_State_Code;
+		}
+		break;
+	case MAX3301_State_Code:
+		gMAX3301.code = (gMAX3301.code << 1) | (bit ? 1 : 0);
+		if (--gMAX3301.bits == 0)
+		{
+			gMAX3301.bits = MAX3301_CLEAR_BITS;
+			gMAX3301.state = MAX3301_State_Clear;
+		}
+		break;
+	case MAX3301_State_Clear:
+		// Discard the remaining bits.
+		if (--gMAX3301.bits == 0)
+		{
+			gMAX3301.state = MAX3301_State_Done;
+		}
+		break;
+	default:
+		break;
 	}
-	return value;
 }
 
 static MAX3301_Fault_t MAX3301_DecodeFaultCode(uint32_t code)
@@ -124,3 +160,31 @@ static MAX3301_Fault_t MAX3301_DecodeFaultCode(uint32_t code)
  * INTERRUPT ROUTINES
  */
 
+static void MAX3301_Clock(void)
+{
+	// The compare also matches once per wrap of the timer.
+	MAX3301_State_t state = gMAX3301.state;
+	if (state == MAX3301_State_Idle || state == MAX3301_State_Done)
+	{
+		return;
+	}
+
+	// Each bit is clocked out by a rising edge on TX, and sampled on RX before it falls.
+	if (!gMAX3301.high)
+	{
+		GPIO_Set(MAX3301_CANTX_PIN);
+		gMAX3301.high = true;
+	}
+	else
+	{
+		bool bit = GPIO_Read(MAX3301_CANRX_PIN);
+		GPIO_Reset(MAX3301_CANTX_PIN);
+		gMAX3301.high = false;
+		MAX3301_ShiftBit(bit);
+	}
+
+	if (gMAX3301.state != MAX3301_State_Done)
+	{
+		TIM_SetPulse(MAX3301_TIM, MAX3301_TIM_CHANNEL, TIM_Read(MAX3301_TIM) + MAX3301_HALF_BIT_US);
+	}
+}
@@ -7,6 +7,12 @@
  * PUBLIC DEFINITIONS
  */
 
+// Half period of the clock used to read the fault code.
+// The MAX3301 has no lower limit, so this is chosen to keep the IRQ load down.
+#ifndef MAX3301_HALF_BIT_US
+#define MAX3301_HALF_BIT_US		10
+#endif
+
 typedef enum {
 	MAX3301_Fault_Unknown = 0,
 	MAX3301_Fault_Overcurrent,
@@ -26,7 +32,14 @@ void MAX3301_Init(void);
 void MAX3301_Deinit(void);
 
 bool MAX3301_IsFaultSet(void);
-MAX3301_Fault_t MAX3301_ClearFault(void);
+
+// Starts reading and clearing the fault. The code is shifted out over the
+// CAN pins, so the controller must release them first. The clock is run from
+// a compare channel of MAX3301_TIM, which must be a free running microsecond timer.
+void MAX3301_StartRead(void);
+bool MAX3301_IsReading(void);
+// True once the read has completed. The CAN pins are then released.
+bool MAX3301_ReadFault(MAX3301_Fault_t * fault);
 
 /*
  * EXTERN DECLARATIONS
@@ -0,0 +1,609 @@
+import canmaster
+import can
+import time
+import threading
+from tests import list_canmasters, test_message, TxBusThread
+
+
+def frame_bits(msg: can.Message) -> int:
+    # Nominal length without stuff bits, including the 3 bit interframe space.
+    header = 64 if msg.is_extended_id else 44
+    return header + 8 * len(msg.data) + 3
+
+
+class FloodThread(threading.Thread):
+    def __init__(self, bus: canmaster.CANMaster, tx_rate: float):
+        super().__init__()
+        self.bus = bus
+        self.running = True
+        self.counter = 0
+        self.tx_rate = tx_rate
+
+    def run(self):
+        t = time.time()
+        while self.running:
+            now = time.time()
+            to_send = int(self.tx_rate * (now - t))
+            if to_send > 0:
+                t += to_send / self.tx_rate
+                for i in range(to_send):
+                    self.bus.send(test_message(self.counter))
+                    self.counter += 1
+            time.sleep(0.001)
+
+    def stop(self):
+        self.running = False
+
+
+def drain(bus: canmaster.CANMaster, duration: float) -> int:
+    count = 0
+    end = time.time() + duration
+    while time.time() < end:
+        if bus.recv(0.01) is not None:
+            count += 1
+    return count
+
+
+def bench_rx_latency(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, latency: int, envelope: bool = False) -> dict:
+    rx.configure_stream(latency_us=latency, envelope=envelope)
+    drain(rx, 0.2)
+
+    flood = FloodThread(tx, config["tx_rate"])
+    flood.start()
+    drain(rx, 0.5)
+
+    before = rx.read_stream_stats()
+    start = time.time()
+    drain(rx, config["test_time"])
+    after = rx.read_stream_stats()
+    elapsed = time.time() - start
+
+    flood.stop()
+    flood.join()
+    drain(rx, 0.2)
+
+    frames = after["frames"] - before["frames"]
+    transfers = after["transfers"] - before["transfers"]
+    nbytes = after["bytes"] - before["bytes"]
+    return {
+        "latency": latency,
+        "frames/s": frames / elapsed,
+        "transfers/s": transfers / elapsed,
+        "bytes/transfer": nbytes / max(transfers, 1),
+        "bytes/frame": nbytes / max(frames, 1),
+    }
+
+
+def bench_tx_utilization(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # Send as fast as the transmit credit allows, and see how busy the bus gets.
+    tx.configure_stream(flow_control=True)
+    sender = TxBusThread(tx, None)
+    sender.start()
+    drain(rx, 0.5)
+
+    start = time.time()
+    recieved = drain(rx, config["test_time"])
+    elapsed = time.time() - start
+
+    sender.stop()
+    sender.join()
+    tx.configure_stream()
+    drain(rx, 0.2)
+
+    rate = recieved / elapsed
+    return {
+        "frames/s": rate,
+        "utilization": rate * frame_bits(test_message(0)) / config["bitrate"],
+    }
+
+
+def bench_tx_burst(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, dlc: int) -> dict:
+    # A burst written without flow control, as in a flash download. The bus drains far slower
+    # than USB fills the queue, so the deepest point shows how many frames it holds.
+    drain(rx, 0.2)
+    sent = 200
+    for counter in range(sent):
+        tx.send(can.Message(arbitration_id=0x100, data=bytes([counter & 0xFF] * dlc), is_extended_id=False))
+    status = tx.read_status()
+    recieved = drain(rx, 0.5)
+    return {
+        "sent": sent,
+        "recieved": recieved,
+        "queued": status["tx_queued"] if status else None,
+        "size": status["tx_size"] if status else None,
+    }
+
+
+def bench_error_burst(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # Overrun the transmit queue, so every dropped frame raises an error. These should arrive
+    # as a few coalesced reports that account for every drop, rather than one message per drop.
+    tx.configure(config['bitrate'], terminator=True, error_code=True)
+    tx.configure_stream(error_counts=True)
+    drain(rx, 0.2)
+    before = tx.read_error_stats() or {}
+    reports = []
+    tx.on_error_report(lambda code, count, first, last: reports.append((code, count, first, last)))
+
+    sent = 1000
+    for counter in range(sent):
+        tx.send(can.Message(arbitration_id=0x100, data=bytes([counter & 0xFF] * 8), is_extended_id=False))
+    recieved = drain(rx, 1.0)
+    drain(tx, 0.3)
+    after = tx.read_error_stats() or {}
+
+    tx.on_error_report(None)
+    tx.configure_stream()
+    tx.configure(config['bitrate'], terminator=True)
+    code = canmaster.CANMasterError.TRANSMIT_BUFFER_FULL
+    full = [r for r in reports if r[0] == code]
+    return {
+        "sent": sent,
+        "recieved": recieved,
+        "reports": len(full),
+        "reported": sum(r[1] for r in full),
+        "counted": after.get(code, 0) - before.get(code, 0),
+        "span": (full[-1][3] - full[0][2]) if full else 0.0,
+    }
+
+
+def bench_bus_state(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # With the reciever silent, nothing acknowledges the transmitter, which climbs to error passive.
+    # Once acknowledged again, each frame sent takes one off its counter until it is back to active.
+    tx.configure(config['bitrate'], terminator=True, error_code=True)
+    rx.configure(config['bitrate'], terminator=False, silent=True)
+    states = []
+    tx.on_bus_state(lambda state: states.append(state))
+
+    tx.send(can.Message(arbitration_id=0x100, data=bytes(8), is_extended_id=False))
+    drain(tx, 0.2)
+    passive = tx.read_status()
+
+    rx.configure(config['bitrate'], terminator=False)
+    for counter in range(200):
+        tx.send(can.Message(arbitration_id=0x100, data=bytes([counter & 0xFF] * 8), is_extended_id=False))
+    drain(rx, 0.5)
+    drain(tx, 0.2)
+    active = tx.read_status()
+
+    tx.on_bus_state(None)
+    tx.configure(config['bitrate'], terminator=True)
+    return {
+        "states": [(s["state"], s["tec"], s["time"]) for s in states],
+        "passive_tec": passive["tec"] if passive else None,
+        "active_tec": active["tec"] if active else None,
+    }
+
+
+def bench_reconfigure(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, restart: bool) -> dict:
+    # Reconfigure the reciever under steady traffic. Flipping the error codes is applied while the
+    # controller runs, but flipping TX priority restarts it, which loses whatever it held.
+    flood = FloodThread(tx, config["tx_rate"])
+    flood.start()
+    drain(rx, 0.2)
+    before = flood.counter
+    recieved = 0
+    changes = 20
+    for i in range(changes):
+        if restart:
+            rx.configure(config['bitrate'], terminator=False, tx_priority=bool(i & 1))
+        else:
+            rx.configure(config['bitrate'], terminator=False, error_code=bool(i & 1))
+        recieved += drain(rx, 0.05)
+    flood.stop()
+    flood.join()
+    recieved += drain(rx, 0.3)
+    sent = flood.counter - before
+
+    rx.configure(config['bitrate'], terminator=False)
+    stats = rx.read_config_stats() or {}
+    return {
+        "changes": changes,
+        "sent": sent,
+        "recieved": recieved,
+        "blackout": stats.get("restart_max" if restart else "update_max"),
+    }
+
+
+def bench_configure(bus: canmaster.CANMaster, config: dict, bitrates: list[int]) -> dict:
+    # Step through the bitrates, as in a bitrate sweep. Each step returns once the device has acknowledged.
+    times = []
+    acked = 0
+    for bitrate in bitrates:
+        start = time.time()
+        try:
+            bus.configure(bitrate, terminator=True)
+            acked += 1
+        except TimeoutError:
+            pass
+        times.append(time.time() - start)
+    bus.configure(config['bitrate'], terminator=True)
+    return {
+        "steps": len(bitrates),
+        "acked": acked,
+        "mean": sum(times) / len(times),
+        "max": max(times),
+    }
+
+
+def bench_tx_priority(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, tx_priority: bool) -> list[dict]:
+    # Load the queue with low priority traffic, with a trickle of high priority messages through it.
+    tx.configure(config["bitrate"], terminator=True, tx_priority=tx_priority)
+    tx.configure_stream(flow_control=True)
+    drain(rx, 0.2)
+
+    before = tx.read_tx_latency_stats()
+    end = time.time() + config["test_time"]
+    counter = 0
+    while time.time() < end:
+        high = counter % 8 == 0
+        tx.send(test_message(counter), priority=0 if high else 3)
+        counter += 1
+    drain(rx, 0.2)
+    after = tx.read_tx_latency_stats()
+
+    tx.configure_stream()
+    result = []
+    for b, a in zip(before, after):
+        frames = a["frames"] - b["frames"]
+        result.append({
+            "frames": frames,
+            "latency": (a["latency"] - b["latency"]) / max(frames, 1),
+            "latency_max": a["latency_max"],
+        })
+    return result
+
+
+def bench_id_filter(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, wanted: list[int]) -> dict:
+    # Send every standard ID in a range, and count how many reach the host.
+    rx.set_id_list(wanted)
+    drain(rx, 0.2)
+    before = rx.read_filter_stats()
+
+    ids = range(0x000, 0x400)
+    for id in ids:
+        tx.send(can.Message(arbitration_id=id, data=[0], is_extended_id=False))
+        time.sleep(0.0005)
+    recieved = drain(rx, 0.5)
+
+    after = rx.read_filter_stats()
+    rx.set_id_list([])
+    return {
+        "sent": len(ids),
+        "wanted": len([id for id in wanted if id in ids]),
+        "hardware": after["seen"] - before["seen"],
+        "recieved": recieved,
+        "acceptance": after["acceptance"],
+    }
+
+
+def bench_lookup_cost(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # A set too large for the banks, so every frame is checked in software.
+    std_ids = list(range(0x000, 0x800, 2))
+    ext_ids = [0x18FF0000 | (i << 8) for i in range(48)]
+    rx.set_id_bitmap(std_ids, ext_ids)
+    drain(rx, 0.2)
+    before = rx.read_filter_stats()
+
+    for counter in range(2000):
+        ext = counter % 2 == 1
+        id = ext_ids[counter % len(ext_ids)] + (counter % 3 == 0) if ext else counter % 0x800
+        tx.send(can.Message(arbitration_id=id, data=[0], is_extended_id=ext))
+        time.sleep(0.0003)
+    drain(rx, 0.5)
+
+    after = rx.read_filter_stats()
+    rx.set_id_list([])
+    frames = after["seen"] - before["seen"]
+    return {
+        "frames": frames,
+        "accepted": after["accepted"] - before["accepted"],
+        "cycles/frame": (after["cycles"] - before["cycles"]) / max(frames, 1),
+        "cycles_max": after["cycles_max"],
+    }
+
+
+def bench_forward_on_change(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, refresh_ms: int) -> dict:
+    # Cyclic frames on 32 IDs, where each payload only changes every 50th cycle.
+    ids = [0x100 + i * 8 for i in range(32)]
+    rx.set_forwarding(on_change=True, refresh_ms=refresh_ms)
+    drain(rx, 0.2)
+    before = rx.read_stream_stats()
+    change_before = rx.read_change_stats()
+
+    sent = 0
+    end = time.time() + config["test_time"]
+    cycle = 0
+    while time.time() < end:
+        for id in ids:
+            tx.send(can.Message(arbitration_id=id, data=[id & 0xFF, cycle // 50, 0, 0, 0, 0, 0, 0], is_extended_id=False))
+            sent += 1
+        cycle += 1
+        time.sleep(0.01)
+    drain(rx, 0.5)
+
+    after = rx.read_stream_stats()
+    change_after = rx.read_change_stats()
+    rx.set_forwarding()
+    return {
+        "sent": sent,
+        "forwarded": change_after["forwarded"] - change_before["forwarded"],
+        "suppressed": change_after["suppressed"] - change_before["suppressed"],
+        "bytes": after["bytes"] - before["bytes"],
+    }
+
+
+def bench_periodic(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # Two 10ms slots half a period apart, under a flood of host traffic.
+    # The period is measured with the bus timestamps of the recieving device.
+    period = 0.010
+    tx.set_periodic(0, can.Message(arbitration_id=0x080, data=[0] * 8), 10, 0)
+    tx.set_periodic(1, can.Message(arbitration_id=0x081, data=[1] * 8), 10, 5)
+    rx.configure_stream(timestamps=True)
+    drain(rx, 0.2)
+    before = tx.read_periodic_stats()
+
+    flood = FloodThread(tx, config["tx_rate"])
+    flood.start()
+    last = {}
+    periods = []
+    end = time.time() + config["test_time"]
+    counter = 0
+    while time.time() < end:
+        msg = rx.recv(0.01)
+        if msg is None or msg.arbitration_id not in (0x080, 0x081):
+            continue
+        if msg.arbitration_id in last:
+            periods.append(msg.timestamp - last[msg.arbitration_id])
+        last[msg.arbitration_id] = msg.timestamp
+        counter += 1
+        if counter % 100 == 0:
+            tx.update_periodic(0, [counter & 0xFF] * 8)
+    flood.stop()
+    flood.join()
+    drain(rx, 0.2)
+
+    after = tx.read_periodic_stats()
+    tx.stop_periodic(0).stop_periodic(1)
+    rx.configure_stream()
+    sent = after["sent"] - before["sent"]
+    jitter = [abs(p - period) for p in periods]
+    return {
+        "sent": sent,
+        "missed": after["missed"] - before["missed"],
+        "latency": (after["latency"] - before["latency"]) / max(sent, 1),
+        "latency_max": after["latency_max"],
+        "jitter": sum(jitter) / max(len(jitter), 1),
+        "jitter_max": max(jitter, default=0),
+    }
+
+
+def bench_timed(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # Release a burst of messages on a 2ms grid, and measure the gaps on the bus.
+    gap_us = 2000
+    count = 20
+    late = []
+    tx.on_late(lambda id, ext, lateness: late.append(lateness))
+    rx.configure_stream(timestamps=True)
+    drain(rx, 0.2)
+    before = tx.read_timed_stats()
+
+    # Leave time for the burst to reach the device before the first release.
+    start = tx.read_time() + 50000
+    for i in range(count):
+        tx.send_at(can.Message(arbitration_id=0x090, data=[i]), start + i * gap_us)
+
+    stamps = []
+    end = time.time() + 0.05 + count * gap_us * 1e-6 + 0.2
+    while time.time() < end:
+        msg = rx.recv(0.01)
+        if msg is not None and msg.arbitration_id == 0x090:
+            stamps.append(msg.timestamp)
+
+    # Late reports are read along with the statistics.
+    after = tx.read_timed_stats()
+    tx.on_late(None)
+    rx.configure_stream()
+    errors = [abs((b - a) - gap_us * 1e-6) for a, b in zip(stamps, stamps[1:])]
+    return {
+        "recieved": len(stamps),
+        "released": after["released"] - before["released"],
+        "late": len(late),
+        "lateness_max": after["lateness_max"],
+        "gap_error": sum(errors) / max(len(errors), 1),
+        "gap_error_max": max(errors, default=0),
+    }
+
+
+def bench_replay(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict) -> dict:
+    # A trace far longer than the device buffer, with gaps from 200us to 2ms.
+    trace = []
+    t = 0.0
+    for i in range(2000):
+        t += 0.0002 + (i * 7919 % 1800) * 1e-6
+        trace.append(can.Message(timestamp=t, arbitration_id=0x0A0 + (i % 16), data=[i & 0xFF, i >> 8]))
+
+    rx.configure_stream(timestamps=True)
+    drain(rx, 0.2)
+    stamps = []
+
+    def collect():
+        while (msg := rx.recv(0.5)) is not None:
+            stamps.append(msg.timestamp)
+
+    thread = threading.Thread(target=collect)
+    thread.start()
+    status = tx.replay(trace)
+    thread.join()
+    rx.configure_stream()
+
+    # Compare the gaps on the bus with those in the trace.
+    errors = [abs((b - a) - (y.timestamp - x.timestamp)) for a, b, x, y in zip(stamps, stamps[1:], trace, trace[1:])]
+    return {
+        "frames": len(trace),
+        "recieved": len(stamps),
+        "underruns": status["underruns"] if status else None,
+        "error": status["error"] / max(status["played"], 1) if status else None,
+        "error_max": status["error_max"] if status else None,
+        "gap_error_max": max(errors, default=0),
+    }
+
+
+def bench_capture(tx: canmaster.CANMaster, rx: canmaster.CANMaster, config: dict, dlc: int, ext: bool) -> dict:
+    # Fill the capture ring with frames of one shape, then measure how many it held and the upload time.
+    rx.arm_capture(canmaster.CAPTURE_MANUAL, 0xFFFF, 0, quiet=True)
+    time.sleep(0.05)
+    for counter in range(400):
+        tx.send(can.Message(arbitration_id=0x100 + (counter & 0xFF), data=bytes([counter & 0xFF] * dlc), is_extended_id=ext))
+        time.sleep(0.0003)
+    time.sleep(0.05)
+
+    start = time.time()
+    rx.trigger_capture()
+    snapshot = rx.read_capture(2.0)
+    elapsed = time.time() - start
+    frames = snapshot[0] if snapshot else []
+    return {
+        "frames": len(frames),
+        "upload": elapsed,
+    }
+
+
+def print_bench(result: dict):
+    print("Latency %4dus: %8.1f frames/s, %8.1f transfers/s, %5.1f bytes/transfer, %5.2f bytes/frame" % (
+        result["latency"],
+        result["frames/s"],
+        result["transfers/s"],
+        result["bytes/transfer"],
+        result["bytes/frame"]
+    ))
+
+
+def main():
+    ports = list_canmasters()
+    if len(ports) != 2:
+        print("Error: Expected 2 CAN masters, found %d" % len(ports))
+        return
+
+    config = {
+        "bitrate": 1000000,
+        "tx_rate": 6000,
+        "test_time": 3.0
+    }
+
+    busa = canmaster.CANMaster(ports[0])
+    busb = canmaster.CANMaster(ports[1])
+    busa.configure(config['bitrate'], terminator=True)
+    busb.configure(config['bitrate'], terminator=False)
+
+    # A latency of zero flushes on every pass of the main loop.
+    print("Recieve coalescing: bus A -> bus B")
+    for latency in [0, 250, 500, 1000]:
+        print_bench(bench_rx_latency(busa, busb, config, latency))
+
+    print("Recieve envelopes: bus A -> bus B")
+    print_bench(bench_rx_latency(busa, busb, config, 1000, envelope=True))
+    busb.configure_stream()
+
+    rx = busb.read_rx_stats()
+    print("Bus B recieve ring: %d recieved, %d dropped, %d FIFO overruns, %d peak" % (rx["recieved"], rx["dropped"], rx["overruns"], rx["peak"]))
+
+    # Stuff bits are not counted, so a saturated bus reads slightly under 100%.
+    print("Transmit saturation: bus A -> bus B")
+    result = bench_tx_utilization(busa, busb, config)
+    print("%8.1f frames/s, %5.1f%% bus utilization" % (result["frames/s"], result["utilization"] * 100))
+
+    # Wanted IDs scattered in clumps, as in a typical vehicle bus.
+    wanted = sorted(set([0x100 + i * 3 for i in range(40)] + [0x300 + i for i in range(0, 80, 5)] + [0x050, 0x1F4, 0x3E8]))
+    print("ID list of %d filters: bus A -> bus B" % len(wanted))
+    result = bench_id_filter(busa, busb, config, wanted)
+    print("%d sent, %d wanted, %d passed the banks, %d recieved, %.1f%% of the banked ID space wanted" % (
+        result["sent"], result["wanted"], result["hardware"], result["recieved"], result["acceptance"] * 100))
+
+    print("Software ID lookup: bus A -> bus B")
+    result = bench_lookup_cost(busa, busb, config)
+    print("%d frames checked, %d accepted, %.1f cycles/frame, %d cycles max" % (
+        result["frames"], result["accepted"], result["cycles/frame"], result["cycles_max"]))
+
+    print("Periodic transmit under load: bus A -> bus B")
+    result = bench_periodic(busa, busb, config)
+    print("%d sent, %d missed, %.1fus mean and %.1fus max until loaded, %.1fus mean and %.1fus max period jitter" % (
+        result["sent"], result["missed"], result["latency"] * 1e6, result["latency_max"] * 1e6,
+        result["jitter"] * 1e6, result["jitter_max"] * 1e6))
+
+    print("Timed transmit: bus A -> bus B")
+    result = bench_timed(busa, busb, config)
+    print("%d released, %d recieved, %d late, %.1fus max lateness, %.1fus mean and %.1fus max gap error" % (
+        result["released"], result["recieved"], result["late"], result["lateness_max"] * 1e6,
+        result["gap_error"] * 1e6, result["gap_error_max"] * 1e6))
+
+    print("Trace replay: bus A -> bus B")
+    result = bench_replay(busa, busb, config)
+    print("%d frames, %d recieved, %s underruns, %.1fus mean and %.1fus max device error, %.1fus max gap error on the bus" % (
+        result["frames"], result["recieved"], result["underruns"], (result["error"] or 0) * 1e6,
+        (result["error_max"] or 0) * 1e6, result["gap_error_max"] * 1e6))
+
+    # The ring is packed, so it holds more frames when they are short.
+    for dlc, ext in [(8, False), (8, True), (2, False)]:
+        print("Capture of %d byte %s frames: bus A -> bus B" % (dlc, "extended" if ext else "standard"))
+        result = bench_capture(busa, busb, config, dlc, ext)
+        print("%d frames held, %.1fms to upload" % (result["frames"], result["upload"] * 1e3))
+
+    # A refresh of zero only forwards changes. The USB bytes include the statistics replies.
+    for refresh_ms in [0, 100, 1000]:
+        print("Forward on change, refresh %dms: bus A -> bus B" % refresh_ms)
+        result = bench_forward_on_change(busa, busb, config, refresh_ms)
+        print("%d sent, %d forwarded, %d suppressed, %d USB bytes" % (
+            result["sent"], result["forwarded"], result["suppressed"], result["bytes"]))
+
+    # The queue is packed, so shorter frames queue deeper before any are dropped.
+    for dlc in [8, 2]:
+        print("Transmit burst of %d byte frames: bus A -> bus B" % dlc)
+        result = bench_tx_burst(busa, busb, config, dlc)
+        print("%d sent, %d recieved, %s queued after the burst, %s byte queue" % (
+            result["sent"], result["recieved"], result["queued"], result["size"]))
+
+    print("Bus error states, unacknowledged then recovered: bus A -> bus B")
+    result = bench_bus_state(busa, busb, config)
+    names = ["active", "warning", "passive", "bus off"]
+    start = result["states"][0][2] if result["states"] else 0
+    print(", ".join("%s (TEC %d) at %.2fms" % (names[state], tec, (at - start) * 1e3) for state, tec, at in result["states"]))
+    print("TEC %s while unacknowledged, %s after" % (result["passive_tec"], result["active_tec"]))
+
+    # Repeating the same bitrate skips the restart, so the later steps show the cost of the round trip alone.
+    print("Configure acknowledgement: bus A")
+    sweep = [125000, 250000, 500000, 1000000]
+    result = bench_configure(busa, config, sweep + [config['bitrate']] * len(sweep))
+    print("%d steps, %d acknowledged, %.2fms mean, %.2fms max" % (
+        result["steps"], result["acked"], result["mean"] * 1e3, result["max"] * 1e3))
+
+    # Only a change of bitrate or mode should cost any frames.
+    for restart in [False, True]:
+        print("Reconfigure %s restart: bus A -> bus B" % ("with" if restart else "without"))
+        result = bench_reconfigure(busa, busb, config, restart)
+        print("%d changes, %d sent, %d recieved, %s longest blackout" % (
+            result["changes"], result["sent"], result["recieved"],
+            "%.1fus" % (result["blackout"] * 1e6) if result["blackout"] is not None else "unknown"))
+
+    # Each drop is counted, but only reported once per 100ms.
+    print("Transmit overrun errors: bus A -> bus B")
+    result = bench_error_burst(busa, busb, config)
+    print("%d sent, %d recieved, %d dropped in %d reports over %.1fms, %d counted" % (
+        result["sent"], result["recieved"], result["reported"], result["reports"], result["span"] * 1e3, result["counted"]))
+
+    # In FIFO mode everything shares class 0. With priority, class 0 should wait far less than class 3.
+    for tx_priority in [False, True]:
+        print("Transmit latency, priority %s: bus A -> bus B" % ("on" if tx_priority else "off"))
+        for i, result in enumerate(bench_tx_priority(busa, busb, config, tx_priority)):
+            if result["frames"]:
+                print("Class %d: %6d frames, %7.1fus mean, %7.1fus max" % (i, result["frames"], result["latency"] * 1e6, result["latency_max"] * 1e6))
+    busa.configure(config['bitrate'], terminator=True)
+
+    # The longest pass covers the whole run, including each reconfigure and any transciever fault readout.
+    for name, bus in [("A", busa), ("B", busb)]:
+        loop = bus.read_loop_stats()
+        if loop:
+            print("Bus %s main loop: %d passes, %.1fus longest" % (name, loop["passes"], loop["pass_max"] * 1e6))
+
+
+if __name__ == "__main__":
+    main()
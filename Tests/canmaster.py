@@ -1,9 +1,93 @@
 from enum import Enum
+from collections import deque
 import serial
 import can
+import time
 import typing
+import zlib
 
 CAN_EXT_BIT = 1 << 5
+CAN_TIME_BIT = 1 << 4
+CAN_PRIORITY_BIT = 1 << 4 # The timestamp bit, on transmitted messages
+
+STREAM_TIMESTAMPS = 1 << 0
+STREAM_ENVELOPE = 1 << 1
+STREAM_CREDITS = 1 << 2
+STREAM_FILTER = 1 << 3
+STREAM_ERROR_COUNTS = 1 << 4
+
+CONFIG_TAG_POS = 4
+CONFIG_TAG_MASK = 0x07
+
+ENVELOPE_FILTER = 1 << 1
+ENVELOPE_CAPTURE = 1 << 2
+
+FILTER_32BIT = 1 << 0
+FILTER_LIST = 1 << 1
+FILTER_FIFO1 = 1 << 2
+FILTER_BANKS = 14
+
+ENTRY_EXT_BIT = 1 << 15
+
+STATS_STREAM = 0x00
+STATS_TX_LATENCY = 0x01
+STATS_RX = 0x02
+STATS_FILTER = 0x03
+STATS_CHANGE = 0x04
+STATS_RATE_LIMIT = 0x05
+STATS_PERIODIC = 0x06
+STATS_TIMED = 0x07
+STATS_REPLAY = 0x08
+STATS_CAPTURE = 0x09
+STATS_ERRORS = 0x0A
+STATS_LOOP = 0x0B
+STATS_CONFIG = 0x0C
+
+BUS_ACTIVE = 0x00
+BUS_WARNING = 0x01
+BUS_PASSIVE = 0x02
+BUS_OFF = 0x03
+
+RECOVERY_AUTO = 0x00
+RECOVERY_DELAYED = 0x01
+RECOVERY_MANUAL = 0x02
+
+ID_LIST_CLEAR = 1 << 0
+ID_LIST_APPLY = 1 << 1
+ID_LIST_EXT = 1 << 31
+ID_LIST_PACKET = 64
+ID_BITMAP_PAGE = 64
+
+FORWARD_CHANGE = 1 << 0
+
+RATE_CLEAR = 1 << 0
+RATE_EXT = 1 << 31
+RATE_ENCODE_SIZE = 12
+
+PERIODIC_UPDATE = 1 << 0
+PERIODIC_EXT = 1 << 31
+PERIODIC_SLOTS = 16
+
+TIMED_EXT = 1 << 31
+
+REPLAY_STOP = 0x00
+REPLAY_START = 0x01
+REPLAY_END = 0x02
+REPLAY_EXT = 1 << 31
+REPLAY_SIZE = 64
+REPLAY_PACKET = 8
+REPLAY_DONE = 3
+
+CAPTURE_OFF = 0x00
+CAPTURE_FRAME = 0x01
+CAPTURE_ERROR = 0x02
+CAPTURE_BUS_OFF = 0x03
+CAPTURE_MANUAL = 0x04
+CAPTURE_ERROR_ANY = 0xFF
+CAPTURE_QUIET = 1 << 0
+CAPTURE_EXT = 1 << 31
+
+TX_CLASSES = 4
 
 
 class CANMasterError(Enum):
@@ -44,17 +128,76 @@ def _u16_from_bytes(bytes: bytearray) -> int:
     return (bytes[0]) | (bytes[1] << 8)
 
 
+# Filter banks, as (flags, fr1, fr2) in the bxCAN register layout.
+# A bank on FIFO1 matches the same, but uses the other hardware FIFO.
+
+def _filter_id32(id: int, ext: bool) -> int:
+    return (id << 3) | 0x04 if ext else id << 21
+
+def _filter_id16(id: int) -> int:
+    return id << 5
+
+def filter_mask32(id: int, mask: int, ext: bool = False, fifo: int = 0) -> tuple[int, int, int]:
+    # Matches frames of the given ID type where (frame_id & mask) == (id & mask)
+    flags = FILTER_32BIT | (FILTER_FIFO1 if fifo else 0)
+    return flags, _filter_id32(id, ext), _filter_id32(mask, ext) | 0x04
+
+def filter_list32(id1: int, id2: int, ext: bool = False, fifo: int = 0) -> tuple[int, int, int]:
+    flags = FILTER_32BIT | FILTER_LIST | (FILTER_FIFO1 if fifo else 0)
+    return flags, _filter_id32(id1, ext), _filter_id32(id2, ext)
+
+def filter_mask16(id1: int, mask1: int, id2: int, mask2: int, fifo: int = 0) -> tuple[int, int, int]:
+    # Two standard ID masks
+    flags = FILTER_FIFO1 if fifo else 0
+    fr1 = _filter_id16(id1) | ((_filter_id16(mask1) | 0x08) << 16)
+    fr2 = _filter_id16(id2) | ((_filter_id16(mask2) | 0x08) << 16)
+    return flags, fr1, fr2
+
+def filter_list16(ids: list[int], fifo: int = 0) -> tuple[int, int, int]:
+    # Up to four standard IDs. Unused places repeat the last ID.
+    ids = (list(ids) + [ids[-1]] * 4)[:4]
+    flags = FILTER_LIST | (FILTER_FIFO1 if fifo else 0)
+    fr1 = _filter_id16(ids[0]) | (_filter_id16(ids[1]) << 16)
+    fr2 = _filter_id16(ids[2]) | (_filter_id16(ids[3]) << 16)
+    return flags, fr1, fr2
+
+
 class CANMaster:
     def __init__(self, port: str ):
         self.port = serial.Serial(port, timeout=0.1)
         self.buffer = bytearray()
         self.error_callback = None
+        self.error_report_callback = None
+        self.rx_queue = deque()
+        self.stats = {}
+        self.bitrate = 250000
+        self.flow_control = False
+        self.credits = None
+        self.tx_count = 0
+        self.filter_index = False
+        self.rate_limits = None
+        self.device_time = None
+        self.late_callback = None
+        self.bus_state_callback = None
+        self.replay_status = None
+        self.capture = None
+        self.capture_frames = []
+        self.status = None
+        self.config_ack = None
+        self.config_tag = 0
 
-    def send(self, msg: can.Message):
+    def send(self, msg: can.Message, priority: int = None):
+        # priority selects a transmit class, 0 being the highest, when tx_priority is configured.
+        # Without it, the class is taken from the top two bits of the ID.
+
+        if self.flow_control:
+            self._await_credit()
 
         header = 0xC0
         if msg.is_extended_id:
             header |= CAN_EXT_BIT
+        if priority is not None:
+            header |= CAN_PRIORITY_BIT
         header |= len(msg.data)
         
         data = bytearray()
@@ -64,10 +207,160 @@ class CANMaster:
             data.extend(_u32_to_bytes(msg.arbitration_id))
         else:
             data.extend(_u16_to_bytes(msg.arbitration_id))
+        if priority is not None:
+            data.append(priority)
         data.extend(msg.data)
         data.append(0x55)
         self.port.write(data)
+        self.tx_count = (self.tx_count + 1) & 0xFFFF
     
+    def send_at(self, msg: can.Message, release_us: int):
+        # Holds the message on the device until its microsecond clock reaches release_us.
+        # Use read_time() to find the device clock. These are not counted against the transmit credit.
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x21)
+        data.extend(_u32_to_bytes(release_us & 0xFFFFFFFF))
+        data.extend(_u32_to_bytes(msg.arbitration_id | (TIMED_EXT if msg.is_extended_id else 0)))
+        data.append(len(msg.data))
+        data.extend(bytes(msg.data).ljust(8, b"\x00"))
+        data.append(0x55)
+        self.port.write(data)
+
+    def read_time(self, timeout: float = 1.0) -> int | None:
+        # The device microsecond clock, which wraps every 2^32 us.
+        self.device_time = None
+        self.port.write(bytearray([0xAA, 0x22, 0x55]))
+
+        end = time.time() + timeout
+        while self.device_time is None:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        return self.device_time
+
+    def replay(self, trace: list[can.Message], timeout: float = 1.0) -> dict | None:
+        # Plays the trace onto the bus with the gaps between its timestamps, timed by the device.
+        # The trace is streamed through the device buffer, so it may be any length. Returns the playback statistics.
+        # timeout is the longest wait for progress, so must cover the longest gap in the trace.
+        start = trace[0].timestamp if trace else 0.0
+
+        # A replay left running is stopped, and its final report discarded.
+        self._write_replay_control(REPLAY_STOP)
+        self._await_replay_status(0.05)
+
+        sent = 0
+        played = 0
+        started = False
+        while True:
+            # The device reports each time half its buffer has played.
+            count = min(REPLAY_SIZE - (sent - played), len(trace) - sent)
+            while count > 0:
+                packet = trace[sent:sent + min(count, REPLAY_PACKET)]
+                self._write_replay_frames(packet, start)
+                sent += len(packet)
+                count -= len(packet)
+            if sent == len(trace):
+                self._write_replay_control(REPLAY_END)
+            if not started:
+                self._write_replay_control(REPLAY_START)
+                started = True
+
+            status = self._await_replay_status(timeout)
+            if status is None or status["state"] == REPLAY_DONE:
+                return status
+            played = status["played"]
+
+    def _write_replay_frames(self, frames: list[can.Message], start: float):
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x24)
+        data.append(len(frames))
+        for msg in frames:
+            data.extend(_u32_to_bytes(round((msg.timestamp - start) * 1e6) & 0xFFFFFFFF))
+            data.extend(_u32_to_bytes(msg.arbitration_id | (REPLAY_EXT if msg.is_extended_id else 0)))
+            data.append(len(msg.data))
+            data.extend(bytes(msg.data).ljust(8, b"\x00"))
+        data.append(0x55)
+        self.port.write(data)
+
+    def _write_replay_control(self, command: int):
+        self.port.write(bytearray([0xAA, 0x25, command, 0x55]))
+
+    def _await_replay_status(self, timeout: float) -> dict | None:
+        end = time.time() + timeout
+        while self.replay_status is None:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        status = self.replay_status
+        self.replay_status = None
+        return status
+
+    def arm_capture(self, trigger: int, pre: int, post: int, arbitration_id: int = 0, id_mask: int = 0, is_extended_id: bool = False,
+                    data: bytes = b"", data_mask: bytes = b"", error: int = CAPTURE_ERROR_ANY, quiet: bool = False) -> "CANMaster":
+        # Records frames on the device, keeping up to pre frames from before the trigger and post frames after it.
+        # A CAPTURE_FRAME trigger matches the masked bits of the ID and payload. With quiet set, the frames
+        # are not streamed while the capture records them. Collect the snapshot with read_capture().
+        self.capture = None
+        self.capture_frames = []
+        packet = bytearray()
+        packet.append(0xAA)
+        packet.append(0x27)
+        packet.append(CAPTURE_QUIET if quiet else 0)
+        packet.append(trigger)
+        packet.extend(_u16_to_bytes(pre))
+        packet.extend(_u16_to_bytes(post))
+        packet.extend(_u32_to_bytes(arbitration_id | (CAPTURE_EXT if is_extended_id else 0)))
+        packet.extend(_u32_to_bytes(id_mask))
+        packet.extend(bytes(data).ljust(8, b"\x00"))
+        packet.extend(bytes(data_mask).ljust(8, b"\x00"))
+        packet.append(error)
+        packet.append(0x55)
+        self.port.write(packet)
+        return self
+
+    def stop_capture(self) -> "CANMaster":
+        return self.arm_capture(CAPTURE_OFF, 0, 0)
+
+    def trigger_capture(self) -> "CANMaster":
+        # Fires an armed capture, whatever its trigger.
+        self.port.write(bytearray([0xAA, 0x28, 0x55]))
+        return self
+
+    def set_recovery(self, policy: int = RECOVERY_AUTO, delay_ms: int = 0) -> "CANMaster":
+        # Sets how the device leaves bus off. The delay only applies to RECOVERY_DELAYED.
+        packet = bytearray([0xAA, 0x2B, policy])
+        packet.extend(_u16_to_bytes(delay_ms))
+        packet.append(0x55)
+        self.port.write(packet)
+        return self
+
+    def recover(self) -> "CANMaster":
+        # Starts the recovery from bus off, for RECOVERY_MANUAL.
+        self.port.write(bytearray([0xAA, 0x2C, 0x55]))
+        return self
+
+    def read_capture(self, timeout: float = 1.0) -> tuple[list[can.Message], int] | None:
+        # Waits for the snapshot, and returns its frames with the index of the first after the trigger.
+        # For a frame trigger, this is the trigger frame.
+        end = time.time() + timeout
+        while self.capture is None or len(self.capture_frames) < self.capture["frames"]:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        frames = self.capture_frames
+        before = self.capture["before"]
+        self.capture = None
+        self.capture_frames = []
+        return frames, before
+
     def recv(self, timeout: float = None):
 
         # Check our current buffer for data
@@ -80,14 +373,396 @@ class CANMaster:
             return self._get_next_message()
         return None
 
+    def configure_stream(self, latency_us: int = 250, timestamps: bool = False, envelope: bool = False, flow_control: bool = False, filter_index: bool = False, error_counts: bool = False) -> "CANMaster":
+        # latency_us is the maximum time the device holds recieved data before sending a partial USB packet.
+        # If timestamps are enabled, recieved messages carry the bus time of their start of frame.
+        # If envelopes are enabled, recieved messages are batched under a single CRC.
+        # If flow control is enabled, send() waits for credit from the device so the transmit queue never overflows.
+        #   The credit is read from the port, so send and recv should not be called from different threads.
+        # If filter_index is enabled, the index of the matching filter is returned as the message channel.
+        # If error_counts is enabled, errors are reported with their occurrences and times, see on_error_report.
+        flags = 0x00
+        if timestamps:
+            flags |= STREAM_TIMESTAMPS
+        if envelope:
+            flags |= STREAM_ENVELOPE
+        if flow_control:
+            flags |= STREAM_CREDITS
+        if filter_index:
+            flags |= STREAM_FILTER
+        if error_counts:
+            flags |= STREAM_ERROR_COUNTS
+
+        # The device restarts its count of recieved messages from this packet.
+        self.flow_control = flow_control
+        self.filter_index = filter_index
+        self.credits = None
+        self.tx_count = 0
+
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x16)
+        data.append(flags)
+        data.extend(_u16_to_bytes(latency_us))
+        data.append(0x55)
+        self.port.write(data)
+        return self
+
+    def set_filters(self, banks: list[tuple[int, int, int]]) -> "CANMaster":
+        # Replaces every filter bank. Filters are indexed in order across the banks.
+        # An empty list returns to the filter given to configure().
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x1A)
+        data.append(len(banks))
+        for flags, fr1, fr2 in banks:
+            data.append(flags)
+            data.extend(_u32_to_bytes(fr1))
+            data.extend(_u32_to_bytes(fr2))
+        data.append(0x55)
+        self.port.write(data)
+        return self
+
+    def set_id_list(self, ids: list[int], ext_ids: list[int] = []) -> "CANMaster":
+        # Accepts only the given IDs. The device works out the filter banks, and checks
+        # anything the banks let through in software. An empty list returns to the configured filter.
+        words = [id for id in ids] + [id | ID_LIST_EXT for id in ext_ids]
+        packets = [words[i:i + ID_LIST_PACKET] for i in range(0, len(words), ID_LIST_PACKET)] or [[]]
+        for i, packet in enumerate(packets):
+            flags = ID_LIST_CLEAR if i == 0 else 0
+            if i == len(packets) - 1:
+                flags |= ID_LIST_APPLY
+            data = bytearray()
+            data.append(0xAA)
+            data.append(0x1B)
+            data.append(flags)
+            data.append(len(packet))
+            for word in packet:
+                data.extend(_u32_to_bytes(word))
+            data.append(0x55)
+            self.port.write(data)
+        return self
+
+    def set_id_bitmap(self, ids: list[int], ext_ids: list[int] = []) -> "CANMaster":
+        # As set_id_list, but the standard IDs are uploaded as a bitmap of the whole ID space.
+        # This suits large sets, which are left for the device to check in software.
+        bitmap = bytearray(2048 // 8)
+        for id in ids:
+            bitmap[id >> 3] |= 1 << (id & 7)
+
+        pages = len(bitmap) // ID_BITMAP_PAGE
+        for page in range(pages):
+            flags = ID_LIST_CLEAR if page == 0 else 0
+            if page == pages - 1 and not ext_ids:
+                flags |= ID_LIST_APPLY
+            data = bytearray()
+            data.append(0xAA)
+            data.append(0x1C)
+            data.append(flags)
+            data.append(page)
+            data.extend(bitmap[page * ID_BITMAP_PAGE:(page + 1) * ID_BITMAP_PAGE])
+            data.append(0x55)
+            self.port.write(data)
+
+        words = [id | ID_LIST_EXT for id in ext_ids]
+        for i in range(0, len(words), ID_LIST_PACKET):
+            packet = words[i:i + ID_LIST_PACKET]
+            flags = ID_LIST_APPLY if i + ID_LIST_PACKET >= len(words) else 0
+            data = bytearray()
+            data.append(0xAA)
+            data.append(0x1B)
+            data.append(flags)
+            data.append(len(packet))
+            for word in packet:
+                data.extend(_u32_to_bytes(word))
+            data.append(0x55)
+            self.port.write(data)
+        return self
+
+    def set_forwarding(self, on_change: bool = False, refresh_ms: int = 0) -> "CANMaster":
+        # If on_change is enabled, a recieved message is only forwarded when its data or length
+        # differs from the last one forwarded with its ID, or refresh_ms has passed since.
+        # A refresh of zero never repeats an unchanged message.
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x1D)
+        data.append(FORWARD_CHANGE if on_change else 0)
+        data.extend(_u16_to_bytes(refresh_ms))
+        data.append(0x55)
+        self.port.write(data)
+        return self
+
+    def set_rate_limit(self, id: int, ext: bool = False, every: int = 1, interval_ms: int = 0, clear: bool = False) -> "CANMaster":
+        # Forwards only every nth recieved message with this ID, and no sooner than interval_ms after the last.
+        # An entry with every of 1 and no interval is removed. If clear is set, the table is emptied first.
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x1E)
+        data.append(RATE_CLEAR if clear else 0)
+        data.extend(_u32_to_bytes(id | (RATE_EXT if ext else 0)))
+        data.extend(_u16_to_bytes(every))
+        data.extend(_u16_to_bytes(interval_ms))
+        data.append(0x55)
+        self.port.write(data)
+        return self
+
+    def clear_rate_limits(self) -> "CANMaster":
+        # An entry that passes everything is not added, so this only clears.
+        return self.set_rate_limit(0, clear=True)
+
+    def read_rate_limits(self, timeout: float = 1.0) -> list[dict] | None:
+        self.rate_limits = None
+        self.port.write(bytearray([0xAA, 0x1F, 0x55]))
+
+        end = time.time() + timeout
+        while self.rate_limits is None:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        return self.rate_limits
+
+    def set_periodic(self, slot: int, msg: can.Message, period_ms: int, phase_ms: int = 0) -> "CANMaster":
+        # The device sends the message every period_ms, ahead of anything queued by send().
+        # Slots are aligned to a shared timeline, so slots with the same period keep the offset between their phases.
+        # A period of zero stops the slot.
+        return self._write_periodic(slot, 0, msg, period_ms, phase_ms)
+
+    def update_periodic(self, slot: int, data: bytes) -> "CANMaster":
+        # Replaces the payload of a running slot, without changing its ID or timing.
+        msg = can.Message(arbitration_id=0, data=data)
+        return self._write_periodic(slot, PERIODIC_UPDATE, msg, 0, 0)
+
+    def stop_periodic(self, slot: int) -> "CANMaster":
+        return self._write_periodic(slot, 0, can.Message(arbitration_id=0), 0, 0)
+
+    def _write_periodic(self, slot: int, flags: int, msg: can.Message, period_ms: int, phase_ms: int) -> "CANMaster":
+        data = bytearray()
+        data.append(0xAA)
+        data.append(0x20)
+        data.append(slot)
+        data.append(flags)
+        data.extend(_u16_to_bytes(period_ms))
+        data.extend(_u16_to_bytes(phase_ms))
+        data.extend(_u32_to_bytes(msg.arbitration_id | (PERIODIC_EXT if msg.is_extended_id else 0)))
+        data.append(len(msg.data))
+        data.extend(bytes(msg.data).ljust(8, b"\x00"))
+        data.append(0x55)
+        self.port.write(data)
+        return self
+
+    def read_filter_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_FILTER, timeout)
+        if payload is None:
+            return None
+        stats = {
+            "ids": _u32_from_bytes(payload[0:4]),
+            "matched": _u32_from_bytes(payload[4:8]),
+            "seen": _u32_from_bytes(payload[8:12]),
+            "accepted": _u32_from_bytes(payload[12:16]),
+            "cycles": _u32_from_bytes(payload[16:20]),
+            "cycles_max": _u32_from_bytes(payload[20:24]),
+        }
+        # The share of the ID space let through by the hardware that was actually wanted
+        stats["acceptance"] = stats["ids"] / max(stats["matched"], 1)
+        return stats
+
+    def read_status(self, timeout: float = 1.0) -> dict | None:
+        # The transmit queue is packed, so the free slots are for messages of any size.
+        self.status = None
+        packet = bytearray([0xAA, 0x55, 0x04]) + bytearray(16)
+        packet.append(sum(packet[2:19]) & 0xFF)
+        self.port.write(packet)
+
+        end = time.time() + timeout
+        while self.status is None:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        return self.status
+
+    def read_stats(self, page: int, timeout: float = 1.0) -> bytearray | None:
+        self.stats.pop(page, None)
+        self.port.write(bytearray([0xAA, 0x19, page, 0x55]))
+
+        end = time.time() + timeout
+        while page not in self.stats:
+            remaining = end - time.time()
+            if remaining <= 0:
+                return None
+            self._await_data(remaining)
+            self._process_buffer()
+        return self.stats.pop(page)
+
+    def read_stream_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_STREAM, timeout)
+        if payload is None:
+            return None
+        return {
+            "frames": _u32_from_bytes(payload[0:4]),
+            "bytes": _u32_from_bytes(payload[4:8]),
+            "transfers": _u32_from_bytes(payload[8:12]),
+            "latency": _u32_from_bytes(payload[12:16]),
+        }
+
+    def read_tx_latency_stats(self, timeout: float = 1.0) -> list[dict] | None:
+        # Time from queueing until loaded into a mailbox, for each transmit class
+        payload = self.read_stats(STATS_TX_LATENCY, timeout)
+        if payload is None:
+            return None
+        classes = []
+        for i in range(TX_CLASSES):
+            words = payload[i * 12:(i + 1) * 12]
+            classes.append({
+                "frames": _u32_from_bytes(words[0:4]),
+                "latency": _u32_from_bytes(words[4:8]) * 1e-6,
+                "latency_max": _u32_from_bytes(words[8:12]) * 1e-6,
+            })
+        return classes
+
+    def read_rx_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_RX, timeout)
+        if payload is None:
+            return None
+        return {
+            "recieved": _u32_from_bytes(payload[0:4]),
+            "dropped": _u32_from_bytes(payload[4:8]),
+            "overruns": _u32_from_bytes(payload[8:12]),
+            "peak": _u32_from_bytes(payload[12:16]),
+        }
+
+    def read_change_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_CHANGE, timeout)
+        if payload is None:
+            return None
+        return {
+            "ids": _u32_from_bytes(payload[0:4]),
+            "forwarded": _u32_from_bytes(payload[4:8]),
+            "suppressed": _u32_from_bytes(payload[8:12]),
+            "uncached": _u32_from_bytes(payload[12:16]),
+        }
+
+    def read_rate_limit_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_RATE_LIMIT, timeout)
+        if payload is None:
+            return None
+        return {
+            "entries": _u32_from_bytes(payload[0:4]),
+            "passed": _u32_from_bytes(payload[4:8]),
+            "dropped": _u32_from_bytes(payload[8:12]),
+        }
+
+    def read_periodic_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_PERIODIC, timeout)
+        if payload is None:
+            return None
+        return {
+            "sent": _u32_from_bytes(payload[0:4]),
+            "missed": _u32_from_bytes(payload[4:8]),
+            "latency": _u32_from_bytes(payload[8:12]) * 1e-6,
+            "latency_max": _u32_from_bytes(payload[12:16]) * 1e-6,
+        }
+
+    def read_timed_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_TIMED, timeout)
+        if payload is None:
+            return None
+        return {
+            "queued": _u32_from_bytes(payload[0:4]),
+            "dropped": _u32_from_bytes(payload[4:8]),
+            "released": _u32_from_bytes(payload[8:12]),
+            "late": _u32_from_bytes(payload[12:16]),
+            "lateness_max": _u32_from_bytes(payload[16:20]) * 1e-6,
+        }
+
+    def read_replay_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_REPLAY, timeout)
+        if payload is None:
+            return None
+        return {
+            "state": _u32_from_bytes(payload[0:4]),
+            "played": _u32_from_bytes(payload[4:8]),
+            "underruns": _u32_from_bytes(payload[8:12]),
+            "error": _u32_from_bytes(payload[12:16]) * 1e-6,
+            "error_max": _u32_from_bytes(payload[16:20]) * 1e-6,
+        }
+
+    def read_capture_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_CAPTURE, timeout)
+        if payload is None:
+            return None
+        return {
+            "state": _u32_from_bytes(payload[0:4]),
+            "trigger": _u32_from_bytes(payload[4:8]),
+            "frames": _u32_from_bytes(payload[8:12]),
+            "before": _u32_from_bytes(payload[12:16]),
+            "recorded": _u32_from_bytes(payload[16:20]),
+            "overwritten": _u32_from_bytes(payload[20:24]),
+        }
+
+    def read_error_stats(self, timeout: float = 1.0) -> dict | None:
+        # occurrences of each error code since startup
+        payload = self.read_stats(STATS_ERRORS, timeout)
+        if payload is None:
+            return None
+        counts = {}
+        for i in range(0, len(payload) - 3, 4):
+            code = i // 4
+            if code in CANMasterError._value2member_map_:
+                counts[CANMasterError(code)] = _u32_from_bytes(payload[i:i+4])
+        return counts
+
+    def read_loop_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_LOOP, timeout)
+        if payload is None:
+            return None
+        return {
+            "passes": _u32_from_bytes(payload[0:4]),
+            "pass_max": _u32_from_bytes(payload[4:8]) * 1e-6,
+        }
+
+    def read_config_stats(self, timeout: float = 1.0) -> dict | None:
+        payload = self.read_stats(STATS_CONFIG, timeout)
+        if payload is None:
+            return None
+        return {
+            "count": _u32_from_bytes(payload[0:4]),
+            "restarts": _u32_from_bytes(payload[4:8]),
+            "last": _u32_from_bytes(payload[8:12]) * 1e-6,
+            "restart_max": _u32_from_bytes(payload[12:16]) * 1e-6,
+            "update_max": _u32_from_bytes(payload[16:20]) * 1e-6,
+        }
+
     def on_error(self, callback: typing.Callable[[CANMasterError], None] ):
         # register a callback for the error condition
         self.error_callback = callback
 
+    def on_error_report(self, callback: typing.Callable[[CANMasterError, int, float, float], None]):
+        # register a callback for each error report, given the code, the occurrences since
+        # the last report, and the device times in seconds of the first and last of them.
+        # These are only sent once error counts are enabled with configure_stream.
+        self.error_report_callback = callback
+
+    def on_late(self, callback: typing.Callable[[int, bool, float], None]):
+        # register a callback for timed messages sent late, given the ID, extended flag and lateness in seconds
+        self.late_callback = callback
+
+    def on_bus_state(self, callback: typing.Callable[[dict], None]):
+        # register a callback for changes of the bus error state. These are sent when error codes are enabled.
+        self.bus_state_callback = callback
+
     def _handle_error(self, code: int):
         if self.error_callback is not None:
             self.error_callback(CANMasterError(code))
 
+    def _handle_error_count(self, code: int, count: int, first: int, last: int):
+        self._handle_error(code)
+        if self.error_report_callback is not None:
+            self.error_report_callback(CANMasterError(code), count, first * 1e-6, last * 1e-6)
+
     def _await_data(self, timeout: float = None) -> bytearray:
         # Wait for one or more bytes to be available
         self.port.timeout = timeout
@@ -101,14 +776,21 @@ class CANMaster:
         self.buffer.extend(data)
 
     def _get_next_message(self) -> can.Message | None:
+        if not self.rx_queue:
+            self._process_buffer()
+        if self.rx_queue:
+            return self.rx_queue.popleft()
+        return None
+
+    def _process_buffer(self):
+        # Decode everything available, so replies are not held up behind CAN messages
         while len(self.buffer):
             index, msg = self._read_message(self.buffer)
             if index == 0:
                 break
             self.buffer = self.buffer[index:]
             if msg is not None:
-                return msg
-        return None
+                self.rx_queue.append(msg)
 
     def _find_header(self, buffer: bytearray) -> int:
         for i in range(len(buffer)):
@@ -133,6 +815,10 @@ class CANMaster:
             # Can message?
             return self._read_can_message(buffer, header)
 
+        elif header == 0x55:
+            # Status reply?
+            return self._read_status_message(buffer), None
+
         elif header == 0x15:
             # Error message?
             n, error_code = self._read_error_message(buffer)
@@ -140,6 +826,53 @@ class CANMaster:
                 self._handle_error(error_code)
             return n, None
 
+        elif header == 0x17:
+            # Envelope of CAN messages?
+            return self._read_envelope(buffer), None
+
+        elif header == 0x18:
+            # Credit report?
+            return self._read_credit_message(buffer), None
+
+        elif header == 0x19:
+            # Statistics reply?
+            return self._read_stats_message(buffer), None
+
+        elif header == 0x1F:
+            # Rate limit table?
+            return self._read_rate_limit_message(buffer), None
+
+        elif header == 0x22:
+            # Device time?
+            return self._read_time_message(buffer), None
+
+        elif header == 0x23:
+            # Late timed message?
+            return self._read_late_message(buffer), None
+
+        elif header == 0x26:
+            # Replay progress?
+            return self._read_replay_message(buffer), None
+
+        elif header == 0x29:
+            # Capture snapshot?
+            return self._read_capture_message(buffer), None
+
+        elif header == 0x2A:
+            # Bus state change?
+            return self._read_bus_state_message(buffer), None
+
+        elif header == 0x2D:
+            # Configuration acknowledgement?
+            return self._read_config_ack_message(buffer), None
+
+        elif header == 0x2E:
+            # Error count message?
+            n, report = self._read_error_count_message(buffer)
+            if report is not None:
+                self._handle_error_count(*report)
+            return n, None
+
         else:
             # Unknown. Discard it.
             return 2, None
@@ -147,8 +880,12 @@ class CANMaster:
     def _read_can_message(self, buffer: bytearray, header: int) -> tuple[int, can.Message | None]:
         dlc = header & 0x0F
         is_extended = (header & CAN_EXT_BIT) != 0
+        has_time = (header & CAN_TIME_BIT) != 0
 
-        total_length = dlc + 3 + (4 if is_extended else 2)
+        id_length = 4 if is_extended else 2
+        filter_length = 1 if self.filter_index else 0
+        time_length = 4 if has_time else 0
+        total_length = dlc + 3 + id_length + filter_length + time_length
 
         # check for remaining length
         if len(buffer) < total_length:
@@ -161,14 +898,74 @@ class CANMaster:
         # we can decode the message out of the buffer
         if is_extended:
             arbitration_id = _u32_from_bytes(buffer[2:6])
-            data = buffer[6:6+dlc]
         else:
             arbitration_id = _u16_from_bytes(buffer[2:4])
-            data = buffer[4:4+dlc]
 
-        return total_length, can.Message(arbitration_id=arbitration_id, data=data, is_extended_id=is_extended, dlc=dlc)
+        index = 2 + id_length
+        channel = None
+        if self.filter_index:
+            channel = buffer[index]
+            index += 1
+
+        timestamp = 0.0
+        if has_time:
+            # The device counts in CAN bit times. This wraps every 2^32 bits.
+            ticks = _u32_from_bytes(buffer[index:index+4])
+            timestamp = ticks / self.bitrate
+            index += 4
+
+        data = buffer[index:index+dlc]
+
+        return total_length, can.Message(timestamp=timestamp, arbitration_id=arbitration_id, data=data, is_extended_id=is_extended, dlc=dlc, channel=channel)
+
+    def _read_envelope(self, buffer: bytearray) -> int:
+        if len(buffer) < 5:
+            return 0
+
+        flags = buffer[2]
+        length = _u16_from_bytes(buffer[3:5])
+        total_length = 5 + length + 5
+
+        # check for a complete message.
+        if len(buffer) < total_length:
+            return 0
+
+        # The CRC validates the whole batch, so the entries need no stop chars.
+        crc = _u32_from_bytes(buffer[5+length:9+length])
+        if buffer[total_length-1] != 0x55 or zlib.crc32(buffer[2:5+length]) != crc:
+            # Only the header is discarded, in case this was a false start.
+            return 2
+
+        has_time = (flags & STREAM_TIMESTAMPS) != 0
+        has_filter = (flags & ENVELOPE_FILTER) != 0
+        # Capture snapshots share the format, but are kept apart from the stream.
+        queue = self.capture_frames if (flags & ENVELOPE_CAPTURE) else self.rx_queue
+        index = 5
+        end = 5 + length
+        while index < end:
+            header = _u16_from_bytes(buffer[index:index+2])
+            index += 2
+            is_extended = (header & ENTRY_EXT_BIT) != 0
+            dlc = (header >> 11) & 0x0F
+            arbitration_id = header & 0x7FF
+            if is_extended:
+                arbitration_id |= (buffer[index] | (buffer[index+1] << 8) | (buffer[index+2] << 16)) << 11
+                index += 3
+            channel = None
+            if has_filter:
+                channel = buffer[index]
+                index += 1
+            timestamp = 0.0
+            if has_time:
+                timestamp = _u32_from_bytes(buffer[index:index+4]) / self.bitrate
+                index += 4
+            data = buffer[index:index+dlc]
+            index += dlc
+            queue.append(can.Message(timestamp=timestamp, arbitration_id=arbitration_id, data=data, is_extended_id=is_extended, dlc=dlc, channel=channel))
 
-    def _read_error_message(self, buffer: bytearray) -> tuple[int, str | None]:
+        return total_length
+
+    def _read_error_message(self, buffer: bytearray) -> tuple[int, int | None]:
 
         # check for a complete message.
         if len(buffer) < 4:
@@ -183,7 +980,189 @@ class CANMaster:
 
         return 4, error_code
 
-    def configure(self, bitrate: int = 250000, terminator: bool = False, silent: bool = False, error_code: bool = False, filter_id: int = 0, filter_mask: int = 0) -> "CANMaster":
+    def _read_error_count_message(self, buffer: bytearray) -> tuple[int, tuple | None]:
+
+        # check for a complete message.
+        if len(buffer) < 16:
+            return 0, None
+
+        # read the error code, its occurrences, and the times of the first and last
+        error_code = buffer[2]
+        count = _u32_from_bytes(buffer[3:7])
+        first = _u32_from_bytes(buffer[7:11])
+        last = _u32_from_bytes(buffer[11:15])
+
+        # check for the stop char
+        if buffer[15] != 0x55:
+            return 16, None
+
+        return 16, (error_code, count, first, last)
+
+    def _read_credit_message(self, buffer: bytearray) -> int:
+        total_length = 7
+
+        # check for a complete message.
+        if len(buffer) < total_length:
+            return 0
+
+        # check for the stop char
+        if buffer[total_length-1] == 0x55:
+            self.credits = (_u16_from_bytes(buffer[2:4]), _u16_from_bytes(buffer[4:6]))
+
+        return total_length
+
+    def _available_credit(self) -> int:
+        if self.credits is None:
+            return 0
+        recieved, free = self.credits
+        # Messages the device had not yet seen when it reported its free space
+        in_flight = (self.tx_count - recieved) & 0xFFFF
+        return free - in_flight
+
+    def _await_credit(self, timeout: float = 1.0):
+        end = time.time() + timeout
+        while self._available_credit() <= 0:
+            remaining = end - time.time()
+            if remaining <= 0:
+                raise TimeoutError("No transmit credit from device")
+            self._await_data(min(remaining, 0.01))
+            self._process_buffer()
+
+    def _read_stats_message(self, buffer: bytearray) -> int:
+        total_length = 5 + buffer[3]
+
+        # check for a complete message.
+        if len(buffer) < total_length:
+            return 0
+
+        # check for the stop char
+        if buffer[total_length-1] == 0x55:
+            self.stats[buffer[2]] = buffer[4:total_length-1]
+
+        return total_length
+
+    def _read_status_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 20:
+            return 0
+        if buffer[2] == 0x04 and buffer[19] == sum(buffer[2:19]) & 0xFF:
+            self.status = {
+                "rx_errors": buffer[3],
+                "tx_errors": buffer[4],
+                "tx_size": _u16_from_bytes(buffer[5:7]),
+                "tx_queued": _u16_from_bytes(buffer[7:9]),
+                "tx_free": _u16_from_bytes(buffer[9:11]),
+                "bus_state": buffer[11],
+                "tec": buffer[12],
+                "rec": buffer[13],
+                "last_error": CANMasterError(buffer[14]) if buffer[14] in CANMasterError._value2member_map_ else buffer[14],
+                "bus_offs": _u16_from_bytes(buffer[15:17]),
+                "recovery": buffer[17],
+            }
+        return 20
+
+    def _read_config_ack_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 24:
+            return 0
+        if buffer[23] == 0x55:
+            flags = buffer[4]
+            self.config_ack = {
+                "sequence": _u16_from_bytes(buffer[2:4]),
+                "restarted": bool(flags & 0x80),
+                "tag": (flags >> CONFIG_TAG_POS) & CONFIG_TAG_MASK,
+                "terminator": bool(flags & 0x01),
+                "silent": bool(flags & 0x02),
+                "error_code": bool(flags & 0x04),
+                "tx_priority": bool(flags & 0x08),
+                "bitrate": _u32_from_bytes(buffer[5:9]),
+                "actual_bitrate": _u32_from_bytes(buffer[9:13]),
+                "sample_point": _u16_from_bytes(buffer[13:15]) / 1000,
+                "filter_id": _u32_from_bytes(buffer[15:19]),
+                "filter_mask": _u32_from_bytes(buffer[19:23]),
+            }
+        return 24
+
+    def _read_bus_state_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 13:
+            return 0
+        if buffer[12] == 0x55 and self.bus_state_callback is not None:
+            self.bus_state_callback({
+                "state": buffer[2],
+                "tec": buffer[3],
+                "rec": buffer[4],
+                "last_error": CANMasterError(buffer[5]) if buffer[5] in CANMasterError._value2member_map_ else buffer[5],
+                "bus_offs": _u16_from_bytes(buffer[6:8]),
+                "time": _u32_from_bytes(buffer[8:12]) * 1e-6,
+            })
+        return 13
+
+    def _read_time_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 7:
+            return 0
+        if buffer[6] == 0x55:
+            self.device_time = _u32_from_bytes(buffer[2:6])
+        return 7
+
+    def _read_late_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 11:
+            return 0
+        if buffer[10] == 0x55 and self.late_callback is not None:
+            key = _u32_from_bytes(buffer[2:6])
+            self.late_callback(key & ~TIMED_EXT, bool(key & TIMED_EXT), _u32_from_bytes(buffer[6:10]) * 1e-6)
+        return 11
+
+    def _read_replay_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 20:
+            return 0
+        if buffer[19] == 0x55:
+            self.replay_status = {
+                "state": buffer[2],
+                "played": _u32_from_bytes(buffer[3:7]),
+                "underruns": _u32_from_bytes(buffer[7:11]),
+                "error": _u32_from_bytes(buffer[11:15]) * 1e-6,
+                "error_max": _u32_from_bytes(buffer[15:19]) * 1e-6,
+            }
+        return 20
+
+    def _read_capture_message(self, buffer: bytearray) -> int:
+        if len(buffer) < 8:
+            return 0
+        if buffer[7] == 0x55:
+            self.capture = {
+                "trigger": buffer[2],
+                "frames": _u16_from_bytes(buffer[3:5]),
+                "before": _u16_from_bytes(buffer[5:7]),
+            }
+            self.capture_frames = []
+        return 8
+
+    def _read_rate_limit_message(self, buffer: bytearray) -> int:
+        total_length = 4 + buffer[2] * RATE_ENCODE_SIZE
+
+        # check for a complete message.
+        if len(buffer) < total_length:
+            return 0
+
+        # check for the stop char
+        if buffer[total_length-1] == 0x55:
+            entries = []
+            for i in range(buffer[2]):
+                entry = buffer[3 + i * RATE_ENCODE_SIZE:]
+                key = _u32_from_bytes(entry[0:4])
+                entries.append({
+                    "id": key & ~RATE_EXT,
+                    "ext": bool(key & RATE_EXT),
+                    "every": _u16_from_bytes(entry[4:6]),
+                    "interval_ms": _u16_from_bytes(entry[6:8]),
+                    "dropped": _u32_from_bytes(entry[8:12]),
+                })
+            self.rate_limits = entries
+
+        return total_length
+
+    def configure(self, bitrate: int = 250000, terminator: bool = False, silent: bool = False, error_code: bool = False, filter_id: int = 0, filter_mask: int = 0, tx_priority: bool = False, timeout: float = 1.0) -> "CANMaster":
+        # If tx_priority is set, the transmit queue is split by priority class and the lowest ID is sent first.
+        # Messages with the same ID are still sent in order.
+        # Returns once the device acknowledges this config, and raises TimeoutError if it does not.
 
         flags = 0x00
         if terminator:
@@ -192,7 +1171,15 @@ class CANMaster:
             flags |= 0x02
         if error_code:
             flags |= 0x04
-        
+        if tx_priority:
+            flags |= 0x08
+
+        # The tag is echoed in the ack, so an ack for an earlier config is not taken for this one.
+        self.config_tag = (self.config_tag + 1) & CONFIG_TAG_MASK
+        flags |= self.config_tag << CONFIG_TAG_POS
+
+        self.bitrate = bitrate
+
         data = bytearray()
         data.append(0xAA)
         data.append(0x13)
@@ -201,8 +1188,19 @@ class CANMaster:
         data.extend(_u32_to_bytes(filter_id))
         data.extend(_u32_to_bytes(filter_mask))
         data.append(0x55)
+        self.config_ack = None
         self.port.write(data)
 
+        # The device acknowledges once the controller is running with the new settings.
+        end = time.time() + timeout
+        while self.config_ack is None or self.config_ack["tag"] != self.config_tag:
+            remaining = end - time.time()
+            if remaining <= 0:
+                self.config_ack = None
+                raise TimeoutError("configuration was not acknowledged")
+            self._await_data(remaining)
+            self._process_buffer()
+
         return self
 
 
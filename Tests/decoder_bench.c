@@ -0,0 +1,193 @@
+// Host measurement of the USB decoder, in bytes and messages per second.
+// A stream of CAN transmit messages is fed to Protocol_Run in USB packets,
+// and decoded into a transmit queue that is emptied as each message lands.
+// Build from the repo root with:
+//   gcc -O2 -ITests/host -ICore Tests/decoder_bench.c Core/Protocol.c Core/Packed.c -o decoder_bench
+
+#include "STM32X.h"
+#include "Protocol.h"
+#include "Packed.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define BENCH_MESSAGES		4096
+#define BENCH_STREAM_MAX	(BENCH_MESSAGES * 16)
+#define BENCH_PACKET		64 // Full speed bulk packet
+#define BENCH_SECONDS		0.5
+
+#define BENCH_CAN			0xC0
+#define BENCH_CAN_EXT		(1 << 5)
+#define BENCH_CAN_PRIORITY	(1 << 4)
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	const char * name;
+	uint8_t len; // Payload bytes, or more than 8 to vary them
+	bool ext;
+	bool priority;
+} Bench_Shape_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static Packed_t * Bench_TxReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len);
+static void Bench_TxCommit(void);
+static uint32_t Bench_RxData(uint8_t * data, uint32_t max);
+static void Bench_TxData(const uint8_t * data, uint32_t len);
+static uint32_t Bench_GetTime(void);
+static uint32_t Bench_TxFree(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static const Protocol_Callback_t cBenchCallbacks = {
+	.tx_reserve = Bench_TxReserve,
+	.tx_commit = Bench_TxCommit,
+	.tx_data = Bench_TxData,
+	.rx_data = Bench_RxData,
+	.get_time = Bench_GetTime,
+	.tx_free = Bench_TxFree,
+};
+
+static const Bench_Shape_t cBenchShapes[] = {
+	{ "standard, 8 bytes", 8, false, false },
+	{ "extended, 8 bytes", 8, true, false },
+	{ "standard, 0 bytes", 0, false, false },
+	{ "standard, 8 bytes, class", 8, false, true },
+	{ "mixed", 9, false, false },
+};
+
+static uint8_t gStream[BENCH_STREAM_MAX];
+static uint32_t gStreamSize;
+static uint32_t gStreamRead;
+
+static uint8_t gTxBuffer[2048];
+static Packed_t gTxQueue;
+static uint32_t gDecoded;
+static uint32_t gChecksum;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Packed_Init(&gTxQueue, gTxBuffer, sizeof(gTxBuffer), sizeof(uint32_t));
+
+	printf("%-26s %10s %10s\n", "messages", "MB/s", "Mmsg/s");
+	for (uint32_t s = 0; s < LENGTH(cBenchShapes); s++)
+	{
+		const Bench_Shape_t * shape = &cBenchShapes[s];
+
+		// Build one stream of messages, which is replayed until the time is up.
+		gStreamSize = 0;
+		for (uint32_t i = 0; i < BENCH_MESSAGES; i++)
+		{
+			bool ext = shape->len > 8 ? (i & 3) == 0 : shape->ext;
+			uint8_t len = shape->len > 8 ? i % 9 : shape->len;
+			uint32_t id = ext ? 0x18DA0000 + i : i & 0x7FF;
+			uint8_t * head = gStream + gStreamSize;
+
+			*head++ = 0xAA;
+			*head++ = BENCH_CAN | (ext ? BENCH_CAN_EXT : 0) | (shape->priority ? BENCH_CAN_PRIORITY : 0) | len;
+			*head++ = id >> 0;
+			*head++ = id >> 8;
+			if (ext)
+			{
+				*head++ = id >> 16;
+				*head++ = id >> 24;
+			}
+			if (shape->priority) { *head++ = i & 3; }
+			for (uint32_t k = 0; k < len; k++) { *head++ = i + k; }
+			*head++ = 0x55;
+			gStreamSize = head - gStream;
+		}
+
+		Protocol_Init(&cBenchCallbacks);
+		uint64_t bytes = 0;
+		uint32_t rounds = 0;
+		gDecoded = 0;
+
+		struct timespec start;
+		struct timespec now;
+		double elapsed;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do
+		{
+			gStreamRead = 0;
+			while (gStreamRead < gStreamSize)
+			{
+				Protocol_Run();
+			}
+			bytes += gStreamSize;
+			rounds += 1;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+		} while (elapsed < BENCH_SECONDS);
+
+		if (gDecoded != rounds * BENCH_MESSAGES)
+		{
+			printf("Error: %u of %u messages decoded\n", gDecoded, rounds * BENCH_MESSAGES);
+			return 1;
+		}
+		printf("%-26s %10.1f %10.2f\n", shape->name, bytes / elapsed / 1e6, gDecoded / elapsed / 1e6);
+	}
+	return gChecksum == 0xFFFFFFFF;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static Packed_t * Bench_TxReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len)
+{
+	uint32_t queued = 0;
+	return Packed_Reserve(&gTxQueue, id, ext, len, &queued) ? &gTxQueue : NULL;
+}
+
+static void Bench_TxCommit(void)
+{
+	// Stands in for the mailbox refill, which reads the frame in place.
+	Packed_Commit(&gTxQueue);
+
+	Packed_Frame_t frame;
+	uint32_t queued;
+	Packed_PeekFrame(&gTxQueue, &frame, &queued);
+	gChecksum += frame.id + Packed_ReadWord(&gTxQueue, &frame, 0) + Packed_ReadWord(&gTxQueue, &frame, 4);
+	Packed_Release(&gTxQueue);
+	gDecoded += 1;
+}
+
+static uint32_t Bench_RxData(uint8_t * data, uint32_t max)
+{
+	// One USB packet at a time, as the CDC driver hands them over.
+	uint32_t count = MIN(MIN(max, BENCH_PACKET), gStreamSize - gStreamRead);
+	memcpy(data, gStream + gStreamRead, count);
+	gStreamRead += count;
+	return count;
+}
+
+static void Bench_TxData(const uint8_t * data, uint32_t len)
+{
+}
+
+static uint32_t Bench_GetTime(void)
+{
+	return 0;
+}
+
+static uint32_t Bench_TxFree(void)
+{
+	return 256;
+}
@@ -0,0 +1,161 @@
+// Host measurement of the software ID check, in cycles per frame.
+// Frames are run through Filter_Accept, against the standard ID bitmap and
+// extended ID hash sets of several sizes, for both wanted and unwanted IDs.
+// A plain scan of the same list of IDs is timed alongside for comparison.
+// Build from the repo root with:
+//   gcc -O2 -ITests/host -ICore Tests/filter_bench.c Core/Filter.c -o filter_bench
+
+#include "STM32X.h"
+#include "Filter.h"
+#include "Cycles.h"
+#include <stdio.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define BENCH_FRAMES		1024
+#define BENCH_ROUNDS		256
+#define BENCH_STD_IDS		256
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	const char * name;
+	bool ext;
+	uint32_t ids; // Wanted IDs listed
+	bool wanted; // Frames carry a listed ID
+	bool pass_ext; // Every extended ID is let through
+} Bench_Case_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static uint32_t Bench_MakeId(uint32_t index, bool ext);
+static bool Bench_Scan(const CAN_Msg_t * msg);
+static uint32_t Bench_Random(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static const Bench_Case_t cBenchCases[] = {
+	{ "standard, wanted", false, BENCH_STD_IDS, true, false },
+	{ "standard, unwanted", false, BENCH_STD_IDS, false, false },
+	{ "extended 8, wanted", true, 8, true, false },
+	{ "extended 8, unwanted", true, 8, false, false },
+	{ "extended 32, wanted", true, 32, true, false },
+	{ "extended 32, unwanted", true, 32, false, false },
+	{ "extended 64, wanted", true, FILTER_EXT_MAX, true, false },
+	{ "extended 64, unwanted", true, FILTER_EXT_MAX, false, false },
+	{ "extended, all passed", true, FILTER_EXT_MAX, false, true },
+};
+
+static CAN_Msg_t gFrames[BENCH_FRAMES];
+static uint32_t gList[BENCH_STD_IDS];
+static uint32_t gListCount;
+static bool gListExt;
+static uint32_t gRandom = 0x12345678;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Filter_Init();
+
+	printf("%-24s %9s %9s  (%s per frame)\n", "frames", "accept", "scan", CYCLES_UNIT);
+	for (uint32_t c = 0; c < LENGTH(cBenchCases); c++)
+	{
+		const Bench_Case_t * bench = &cBenchCases[c];
+
+		// IDs from the even indexes are wanted, and the odd ones are not.
+		Filter_Clear();
+		gListCount = bench->ids;
+		gListExt = bench->ext;
+		for (uint32_t i = 0; i < bench->ids; i++)
+		{
+			gList[i] = Bench_MakeId(i * 2, bench->ext);
+			if (!Filter_Add(gList[i], bench->ext))
+			{
+				printf("Error: %s, ID %u of %u not added\n", bench->name, i, bench->ids);
+				return 1;
+			}
+		}
+		if (bench->pass_ext) { Filter_PassExt(); }
+
+		for (uint32_t i = 0; i < BENCH_FRAMES; i++)
+		{
+			uint32_t index = (Bench_Random() % bench->ids) * 2 + (bench->wanted ? 0 : 1);
+			gFrames[i] = (CAN_Msg_t){ .id = Bench_MakeId(index, bench->ext), .ext = bench->ext, .len = 8 };
+		}
+
+		// The best round of each, so a preempted round does not count.
+		uint64_t best_accept = UINT64_MAX;
+		uint64_t best_scan = UINT64_MAX;
+		uint32_t accepted = 0;
+		uint32_t scanned = 0;
+		for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+		{
+			uint64_t start = Cycles_Read();
+			for (uint32_t i = 0; i < BENCH_FRAMES; i++)
+			{
+				accepted += Filter_Accept(&gFrames[i]);
+			}
+			uint64_t middle = Cycles_Read();
+			for (uint32_t i = 0; i < BENCH_FRAMES; i++)
+			{
+				scanned += Bench_Scan(&gFrames[i]);
+			}
+			uint64_t end = Cycles_Read();
+
+			best_accept = MIN(best_accept, middle - start);
+			best_scan = MIN(best_scan, end - middle);
+		}
+
+		uint32_t expected = (bench->wanted || bench->pass_ext) ? BENCH_ROUNDS * BENCH_FRAMES : 0;
+		if (accepted != expected || scanned != (bench->wanted ? expected : 0))
+		{
+			printf("Error: %s, %u accepted and %u scanned of %u\n", bench->name, accepted, scanned, expected);
+			return 1;
+		}
+		printf("%-24s %9.1f %9.1f\n", bench->name,
+				(double)best_accept / BENCH_FRAMES,
+				(double)best_scan / BENCH_FRAMES);
+	}
+	return 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static uint32_t Bench_MakeId(uint32_t index, bool ext)
+{
+	// Extended IDs cluster as they do on a bus, varying in the low bytes.
+	return ext ? 0x18DA0000 + (index * 0x101) : (index * 3) & 0x7FF;
+}
+
+static bool Bench_Scan(const CAN_Msg_t * msg)
+{
+	for (uint32_t i = 0; i < gListCount; i++)
+	{
+		if (gList[i] == msg->id && gListExt == msg->ext) { return true; }
+	}
+	return false;
+}
+
+static uint32_t Bench_Random(void)
+{
+	// xorshift32, so every run is the same.
+	uint32_t x = gRandom;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	gRandom = x;
+	return x;
+}
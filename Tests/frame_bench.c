@@ -0,0 +1,243 @@
+// Host measurement of the transmit path for each frame, in cycles per frame.
+// USB packets are decoded by Protocol_Run into a Packed queue, and each frame is
+// moved to a stand in mailbox as it lands, the way the main loop refills the bxCAN.
+// The frame is either written from its queue slot, as the firmware does, or copied
+// out through a CAN_Msg_t and a Queue first, as it was before the Packed queue.
+// Build from the repo root with:
+//   gcc -O2 -ITests/host -ICore Tests/frame_bench.c Core/Protocol.c Core/Packed.c Core/Queue.c -o frame_bench
+
+#include "STM32X.h"
+#include "Protocol.h"
+#include "Packed.h"
+#include "Queue.h"
+#include "Cycles.h"
+#include <stdio.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define BENCH_MESSAGES		4096
+#define BENCH_STREAM_MAX	(BENCH_MESSAGES * 16)
+#define BENCH_PACKET		64 // Full speed bulk packet
+#define BENCH_ROUNDS		64
+
+#define BENCH_CAN			0xC0
+#define BENCH_CAN_EXT		(1 << 5)
+
+#define BENCH_TIR_IDE		(1 << 2)
+#define BENCH_TIR_TXRQ		(1 << 0)
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	const char * name;
+	uint8_t len; // Payload bytes, or more than 8 to vary them
+	bool ext;
+} Bench_Shape_t;
+
+// Laid out as a bxCAN transmit mailbox.
+typedef struct {
+	volatile uint32_t TIR;
+	volatile uint32_t TDTR;
+	volatile uint32_t TDLR;
+	volatile uint32_t TDHR;
+} Bench_Mailbox_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static Packed_t * Bench_TxReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len);
+static void Bench_TxInPlace(void);
+static void Bench_TxCopied(void);
+static uint32_t Bench_RxData(uint8_t * data, uint32_t max);
+static void Bench_TxData(const uint8_t * data, uint32_t len);
+static uint32_t Bench_GetTime(void);
+static uint32_t Bench_TxFree(void);
+static void Bench_WriteMailbox(uint32_t id, bool ext, uint32_t len, uint32_t low, uint32_t high);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static Protocol_Callback_t gBenchCallbacks = {
+	.tx_reserve = Bench_TxReserve,
+	.tx_data = Bench_TxData,
+	.rx_data = Bench_RxData,
+	.get_time = Bench_GetTime,
+	.tx_free = Bench_TxFree,
+};
+
+static const Bench_Shape_t cBenchShapes[] = {
+	{ "standard, 8 bytes", 8, false },
+	{ "extended, 8 bytes", 8, true },
+	{ "standard, 0 bytes", 0, false },
+	{ "mixed", 9, false },
+};
+
+static uint8_t gStream[BENCH_STREAM_MAX];
+static uint32_t gStreamSize;
+static uint32_t gStreamRead;
+
+static uint8_t gTxBuffer[2048];
+static Packed_t gTxQueue;
+static CAN_Msg_t gMsgBuffer[64];
+static Queue_t gMsgQueue;
+
+static Bench_Mailbox_t gMailbox;
+static uint32_t gWritten;
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Packed_Init(&gTxQueue, gTxBuffer, sizeof(gTxBuffer), sizeof(uint16_t));
+	Queue_Init(&gMsgQueue, gMsgBuffer, sizeof(*gMsgBuffer), LENGTH(gMsgBuffer));
+
+	printf("%-20s %9s %9s %9s  (%s per frame)\n", "frames", "in place", "copied", "saved", CYCLES_UNIT);
+	for (uint32_t s = 0; s < LENGTH(cBenchShapes); s++)
+	{
+		const Bench_Shape_t * shape = &cBenchShapes[s];
+
+		gStreamSize = 0;
+		for (uint32_t i = 0; i < BENCH_MESSAGES; i++)
+		{
+			bool ext = shape->len > 8 ? (i & 3) == 0 : shape->ext;
+			uint8_t len = shape->len > 8 ? i % 9 : shape->len;
+			uint32_t id = ext ? 0x18DA0000 + i : i & 0x7FF;
+			uint8_t * head = gStream + gStreamSize;
+
+			*head++ = 0xAA;
+			*head++ = BENCH_CAN | (ext ? BENCH_CAN_EXT : 0) | len;
+			*head++ = id >> 0;
+			*head++ = id >> 8;
+			if (ext)
+			{
+				*head++ = id >> 16;
+				*head++ = id >> 24;
+			}
+			for (uint32_t k = 0; k < len; k++) { *head++ = i + k; }
+			*head++ = 0x55;
+			gStreamSize = head - gStream;
+		}
+
+		// The best round of each, so a preempted round does not count.
+		double cycles[2];
+		void (*commits[2])(void) = { Bench_TxInPlace, Bench_TxCopied };
+		for (uint32_t p = 0; p < LENGTH(commits); p++)
+		{
+			gBenchCallbacks.tx_commit = commits[p];
+			Protocol_Init(&gBenchCallbacks);
+			uint64_t best = UINT64_MAX;
+			gWritten = 0;
+			for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+			{
+				gStreamRead = 0;
+				uint64_t start = Cycles_Read();
+				while (gStreamRead < gStreamSize)
+				{
+					Protocol_Run();
+				}
+				uint64_t elapsed = Cycles_Read() - start;
+				if (elapsed < best) { best = elapsed; }
+			}
+
+			if (gWritten != BENCH_ROUNDS * BENCH_MESSAGES)
+			{
+				printf("Error: %u of %u frames written\n", gWritten, BENCH_ROUNDS * BENCH_MESSAGES);
+				return 1;
+			}
+			cycles[p] = (double)best / BENCH_MESSAGES;
+		}
+		printf("%-20s %9.1f %9.1f %9.1f\n", shape->name, cycles[0], cycles[1], cycles[1] - cycles[0]);
+	}
+	return 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static Packed_t * Bench_TxReserve(uint8_t priority, uint32_t id, bool ext, uint8_t len)
+{
+	uint16_t queued = 0;
+	return Packed_Reserve(&gTxQueue, id, ext, len, &queued) ? &gTxQueue : NULL;
+}
+
+static void Bench_TxInPlace(void)
+{
+	// As MAIN_TransmitRefill: from the queue slot to the mailbox a word at a time.
+	Packed_Commit(&gTxQueue);
+
+	Packed_Frame_t frame;
+	uint16_t queued;
+	while (Packed_PeekFrame(&gTxQueue, &frame, &queued))
+	{
+		Bench_WriteMailbox(frame.id, frame.ext, frame.len,
+						   Packed_ReadWord(&gTxQueue, &frame, 0),
+						   Packed_ReadWord(&gTxQueue, &frame, 4));
+		Packed_Release(&gTxQueue);
+	}
+}
+
+static void Bench_TxCopied(void)
+{
+	// Out into a message, through a queue of messages, then packed into the mailbox words.
+	Packed_Commit(&gTxQueue);
+
+	CAN_Msg_t msg;
+	uint16_t queued;
+	while (Packed_Pop(&gTxQueue, &msg, &queued))
+	{
+		Queue_Push(&gMsgQueue, &msg);
+	}
+	while (Queue_Pop(&gMsgQueue, &msg))
+	{
+		Bench_WriteMailbox(msg.id, msg.ext, msg.len,
+						   (msg.data[0] <<  0)
+						 | (msg.data[1] <<  8)
+						 | (msg.data[2] << 16)
+						 | (msg.data[3] << 24),
+						   (msg.data[4] <<  0)
+						 | (msg.data[5] <<  8)
+						 | (msg.data[6] << 16)
+						 | ((uint32_t)msg.data[7] << 24));
+	}
+}
+
+static void Bench_WriteMailbox(uint32_t id, bool ext, uint32_t len, uint32_t low, uint32_t high)
+{
+	gMailbox.TDTR = len;
+	gMailbox.TDLR = low;
+	gMailbox.TDHR = high;
+	gMailbox.TIR = (ext ? (id << 3) | BENCH_TIR_IDE : (id << 21)) | BENCH_TIR_TXRQ;
+	gWritten += 1;
+}
+
+static uint32_t Bench_RxData(uint8_t * data, uint32_t max)
+{
+	// One USB packet at a time, as the CDC driver hands them over.
+	uint32_t count = MIN(MIN(max, BENCH_PACKET), gStreamSize - gStreamRead);
+	memcpy(data, gStream + gStreamRead, count);
+	gStreamRead += count;
+	return count;
+}
+
+static void Bench_TxData(const uint8_t * data, uint32_t len)
+{
+}
+
+static uint32_t Bench_GetTime(void)
+{
+	return 0;
+}
+
+static uint32_t Bench_TxFree(void)
+{
+	return 256;
+}
@@ -0,0 +1,24 @@
+#ifndef CAN_H
+#define CAN_H
+
+// Stands in for the STM32X CAN driver, for the message definitions only.
+
+#include "STM32X.h"
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t id;
+	bool ext;
+	uint8_t len;
+	uint8_t data[8];
+} CAN_Msg_t;
+
+// Only ever passed through, by the modules built here.
+typedef enum {
+	CAN_Error_None,
+} CAN_Error_t;
+
+#endif //CAN_H
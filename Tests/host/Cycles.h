@@ -0,0 +1,39 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+// A timestamp counter for the host benchmarks in this folder. x86 counts
+// reference cycles, and aarch64 its virtual counter. Anywhere else this
+// falls back to nanoseconds, so the unit is printed with the results.
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES_UNIT			"cycles"
+#elif defined(__aarch64__)
+#define CYCLES_UNIT			"ticks"
+#else
+#define CYCLES_UNIT			"ns"
+#endif
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+static inline uint64_t Cycles_Read(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t count;
+	__asm__ volatile ("mrs %0, cntvct_el0" : "=r" (count));
+	return count;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+#endif //CYCLES_H
@@ -0,0 +1,44 @@
+#ifndef STM32X_H
+#define STM32X_H
+
+// Stands in for the STM32X library, so modules can be built on the host for
+// the tests in this folder. Only what those modules use is defined.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+// A full barrier, as the producer and consumer run on separate threads.
+#define __DMB()				__sync_synchronize()
+
+// The simulations that use these run IRQs as plain calls, so there is nothing to mask.
+#define __disable_irq()
+#define __enable_irq()
+
+#define LENGTH(x)			(sizeof(x) / sizeof(*(x)))
+#define MIN(a, b)			((a) < (b) ? (a) : (b))
+#define MAX(a, b)			((a) > (b) ? (a) : (b))
+
+// SysTick reads as stopped, so cycle counts kept by the modules read zero.
+#define SysTick				(&cSysTick)
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t LOAD;
+	uint32_t VAL;
+} SysTick_Type;
+
+/*
+ * PUBLIC VARIABLES
+ */
+
+static const SysTick_Type cSysTick = { .LOAD = 0xFFFFFF };
+
+#endif //STM32X_H
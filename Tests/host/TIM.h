@@ -0,0 +1,63 @@
+#ifndef TIM_H
+#define TIM_H
+
+// Stands in for the STM32X timer driver. The timers do not count by themselves:
+// the program using them defines gTIM_1 and gTIM_2, and steps them along with
+// its simulated clock, calling on_reload where the timer IRQ would fire.
+
+#include "STM32X.h"
+
+/*
+ * PUBLIC TYPES
+ */
+
+typedef struct {
+	uint32_t count;
+	uint32_t freq;
+	uint32_t reload;
+	bool running;
+	void (*on_reload)(void);
+} TIM_t;
+
+/*
+ * PUBLIC DEFINITIONS
+ */
+
+#define TIM_1				(&gTIM_1)
+#define TIM_2				(&gTIM_2)
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+static inline void TIM_Init(TIM_t * tim, uint32_t freq, uint32_t reload)
+{
+	tim->count = 0;
+	tim->freq = freq;
+	tim->reload = reload;
+	tim->running = false;
+}
+
+static inline void TIM_OnReload(TIM_t * tim, void (*on_reload)(void))
+{
+	tim->on_reload = on_reload;
+}
+
+static inline void TIM_Start(TIM_t * tim)
+{
+	tim->running = true;
+}
+
+static inline uint32_t TIM_Read(TIM_t * tim)
+{
+	return tim->count;
+}
+
+/*
+ * EXTERN DECLARATIONS
+ */
+
+extern TIM_t gTIM_1;
+extern TIM_t gTIM_2;
+
+#endif //TIM_H
@@ -0,0 +1,268 @@
+// Host simulation of the periodic scheduler, reporting how far each frame
+// starts on the bus from the tick it was due on. The jitter is the widest
+// spread of that lateness for any one slot, so it is what the period varies by. Periodic_Tick runs from a
+// simulated 1ms TIM_1, and due frames are loaded into three transmit FIFO
+// mailboxes ahead of host traffic, the way the transmit refill does. The bus
+// is shared with other nodes, which win arbitration with a lower ID.
+// Build from the repo root with:
+//   gcc -O2 -ITests/host -ICore Tests/periodic_jitter.c Core/Periodic.c -o periodic_jitter
+
+#include "STM32X.h"
+#include "TIM.h"
+#include "Periodic.h"
+#include <stdio.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define SIM_BITRATE			500000
+#define SIM_SECONDS			20
+#define SIM_MAILBOXES		3
+#define SIM_US				1000000
+
+#define SIM_HOST_ID			0x500
+#define SIM_NONE			0xFF
+
+/*
+ * PRIVATE TYPES
+ */
+
+typedef struct {
+	uint32_t id;
+	uint8_t len;
+	uint8_t slot; // Periodic slot, or SIM_NONE for host traffic
+} Sim_Frame_t;
+
+typedef struct {
+	const char * name;
+	uint32_t other_load; // Percent of the bus used by other nodes
+	bool host_full; // The host transmit queue never runs dry
+} Sim_Scenario_t;
+
+typedef struct {
+	uint32_t id;
+	uint16_t period;
+	uint16_t phase;
+} Sim_Slot_t;
+
+/*
+ * PRIVATE PROTOTYPES
+ */
+
+static void Sim_OnDue(void);
+static void Sim_Refill(void);
+static uint32_t Sim_FrameTime(uint8_t len, bool ext);
+static uint32_t Sim_Random(void);
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+TIM_t gTIM_1;
+TIM_t gTIM_2;
+
+static const Sim_Scenario_t cSimScenarios[] = {
+	{ "idle bus", 0, false },
+	{ "30% other nodes", 30, false },
+	{ "70% other nodes", 70, false },
+	{ "host queue full", 0, true },
+	{ "host full, 70% other", 70, true },
+};
+
+// Two slots share a phase, so one always follows the other.
+static const Sim_Slot_t cSimSlots[] = {
+	{ 0x100, 10, 0 },
+	{ 0x101, 10, 0 },
+	{ 0x200, 20, 5 },
+	{ 0x300, 50, 7 },
+	{ 0x400, 100, 3 },
+	{ 0x6F0, 100, 50 },
+};
+
+static struct {
+	Sim_Frame_t mailbox[SIM_MAILBOXES]; // In request order
+	uint32_t mailbox_count;
+	bool host_full;
+	uint32_t bus_free; // Time the frame on the bus ends
+	bool bus_ours;
+	uint32_t other_pending;
+	uint32_t other_id;
+	uint32_t random;
+} gSim = { .random = 0x12345678 };
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Periodic_Init(Sim_OnDue);
+
+	printf("%u kbit/s, %u slots, lateness from the due tick to the start of frame in us\n",
+			SIM_BITRATE / 1000, (uint32_t)LENGTH(cSimSlots));
+	printf("%-22s %7s %7s %7s %7s %7s %7s\n", "scenario", "frames", "missed", "min", "mean", "max", "jitter");
+	for (uint32_t s = 0; s < LENGTH(cSimScenarios); s++)
+	{
+		const Sim_Scenario_t * scenario = &cSimScenarios[s];
+
+		// Start each scenario from an empty bus, and the slots from their phase.
+		gSim.mailbox_count = 0;
+		gSim.other_pending = 0;
+		gSim.bus_ours = false;
+		gSim.host_full = scenario->host_full;
+		for (uint32_t i = 0; i < LENGTH(cSimSlots); i++)
+		{
+			CAN_Msg_t msg = { .id = cSimSlots[i].id, .len = 8 };
+			Periodic_Set(i, &msg, cSimSlots[i].period, cSimSlots[i].phase);
+		}
+		Sim_Refill();
+
+		Periodic_Stats_t before;
+		Periodic_GetStats(&before);
+
+		// Other nodes send standard 8 byte frames, arriving at random.
+		uint32_t other_time = Sim_FrameTime(8, false);
+		uint32_t other_chance = scenario->other_load * (UINT32_MAX / 100 / other_time);
+
+		uint32_t frames = 0;
+		uint32_t late_min[LENGTH(cSimSlots)];
+		uint32_t late_max[LENGTH(cSimSlots)] = { 0 };
+		uint64_t late_sum = 0;
+		memset(late_min, 0xFF, sizeof(late_min));
+		for (uint32_t t = 0; t < SIM_SECONDS * SIM_US; t++)
+		{
+			uint32_t now = gTIM_2.count + 1;
+			gTIM_2.count = now;
+
+			if (gTIM_1.running && ++gTIM_1.count > gTIM_1.reload)
+			{
+				gTIM_1.count = 0;
+				gTIM_1.on_reload();
+			}
+
+			if (Sim_Random() < other_chance)
+			{
+				if (gSim.other_pending == 0) { gSim.other_id = Sim_Random() & 0x7FF; }
+				gSim.other_pending += 1;
+			}
+
+			if ((int32_t)(now - gSim.bus_free) < 0)
+			{
+				continue;
+			}
+			if (gSim.bus_ours)
+			{
+				// The transmit complete IRQ refills the freed mailbox.
+				gSim.bus_ours = false;
+				gSim.mailbox_count -= 1;
+				memmove(gSim.mailbox, gSim.mailbox + 1, gSim.mailbox_count * sizeof(*gSim.mailbox));
+				Sim_Refill();
+			}
+
+			// The lowest ID wins arbitration.
+			bool ours = gSim.mailbox_count > 0;
+			if (ours && gSim.other_pending && gSim.other_id < gSim.mailbox[0].id)
+			{
+				ours = false;
+			}
+			if (ours)
+			{
+				Sim_Frame_t * frame = &gSim.mailbox[0];
+				gSim.bus_ours = true;
+				gSim.bus_free = now + Sim_FrameTime(frame->len, false);
+				if (frame->slot != SIM_NONE)
+				{
+					// Due on the last tick matching the phase. TIM_2 and the
+					// ticks both started from zero, at Periodic_Init.
+					const Sim_Slot_t * slot = &cSimSlots[frame->slot];
+					uint32_t tick = now / 1000;
+					uint32_t due = tick - ((tick + slot->period - slot->phase % slot->period) % slot->period);
+					uint32_t late = now - due * 1000;
+					frames += 1;
+					late_sum += late;
+					late_min[frame->slot] = MIN(late_min[frame->slot], late);
+					late_max[frame->slot] = MAX(late_max[frame->slot], late);
+				}
+			}
+			else if (gSim.other_pending)
+			{
+				gSim.other_pending -= 1;
+				gSim.other_id = Sim_Random() & 0x7FF;
+				gSim.bus_free = now + other_time;
+			}
+		}
+
+		uint32_t min = UINT32_MAX;
+		uint32_t max = 0;
+		uint32_t jitter = 0;
+		for (uint32_t i = 0; i < LENGTH(cSimSlots); i++)
+		{
+			min = MIN(min, late_min[i]);
+			max = MAX(max, late_max[i]);
+			jitter = MAX(jitter, late_max[i] - late_min[i]);
+		}
+
+		Periodic_Stats_t after;
+		Periodic_GetStats(&after);
+		printf("%-22s %7u %7u %7u %7.1f %7u %7u\n", scenario->name, frames, after.missed - before.missed,
+				min, (double)late_sum / frames, max, jitter);
+	}
+	return 0;
+}
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void Sim_OnDue(void)
+{
+	// CANBus_WriteKick pends the CAN IRQ, which runs the refill.
+	Sim_Refill();
+}
+
+static void Sim_Refill(void)
+{
+	// As MAIN_TransmitRefill: periodic frames first, then the host queue.
+	while (gSim.mailbox_count < SIM_MAILBOXES)
+	{
+		const CAN_Msg_t * periodic = Periodic_Peek();
+		Sim_Frame_t * frame = &gSim.mailbox[gSim.mailbox_count];
+		if (periodic != NULL)
+		{
+			frame->id = periodic->id;
+			frame->len = periodic->len;
+			frame->slot = 0;
+			while (cSimSlots[frame->slot].id != periodic->id) { frame->slot += 1; }
+			Periodic_Release(TIM_Read(TIM_2));
+		}
+		else if (gSim.host_full)
+		{
+			*frame = (Sim_Frame_t){ .id = SIM_HOST_ID, .len = 8, .slot = SIM_NONE };
+		}
+		else
+		{
+			break;
+		}
+		gSim.mailbox_count += 1;
+	}
+}
+
+static uint32_t Sim_FrameTime(uint8_t len, bool ext)
+{
+	// The frame, a typical tenth again of stuff bits, and the interframe space.
+	uint32_t bits = (ext ? 64 : 44) + (len * 8);
+	bits += bits / 10 + 3;
+	return bits * (SIM_US / SIM_BITRATE);
+}
+
+static uint32_t Sim_Random(void)
+{
+	// xorshift32, so every run is the same.
+	uint32_t x = gSim.random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	gSim.random = x;
+	return x;
+}
@@ -0,0 +1,150 @@
+// Host measurement of the Queue operations, in cycles per item.
+// The cycles are the host's, so only compare the columns with each other.
+// Build from the repo root with:
+//   gcc -O2 -ITests/host -ICore Tests/queue_bench.c Core/Queue.c -o queue_bench
+
+#include "STM32X.h"
+#include "Queue.h"
+#include "Cycles.h"
+#include <stdio.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define BENCH_SIZE			32
+#define BENCH_ROUNDS		100000
+
+/*
+ * PRIVATE TYPES
+ */
+
+// Same shape as a Timed_Late_t
+typedef struct {
+	uint32_t id;
+	bool ext;
+	uint32_t lateness;
+} Bench_Item_t;
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static Bench_Item_t gBuffer[BENCH_SIZE];
+static Queue_t gQueue;
+static volatile uint32_t gSink;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static void Bench_Fill(uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		Bench_Item_t * item = Queue_Reserve(&gQueue);
+		item->id = i;
+		item->ext = false;
+		item->lateness = i;
+		Queue_Commit(&gQueue);
+	}
+}
+
+static uint64_t Bench_PushPop(uint32_t batch)
+{
+	uint64_t start = Cycles_Read();
+	for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+	{
+		Bench_Item_t item = { .id = r };
+		for (uint32_t i = 0; i < batch; i++)
+		{
+			Queue_Push(&gQueue, &item);
+		}
+		while (Queue_Pop(&gQueue, &item))
+		{
+			gSink += item.lateness;
+		}
+	}
+	return Cycles_Read() - start;
+}
+
+static uint64_t Bench_Bulk(uint32_t batch)
+{
+	// Copied in and out a batch at a time.
+	Bench_Item_t items[BENCH_SIZE];
+	for (uint32_t i = 0; i < batch; i++)
+	{
+		items[i] = (Bench_Item_t){ .id = i, .lateness = i };
+	}
+
+	uint64_t start = Cycles_Read();
+	for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+	{
+		Queue_PushN(&gQueue, items, batch);
+		uint32_t count = Queue_PopN(&gQueue, items, batch);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			gSink += items[i].lateness;
+		}
+	}
+	return Cycles_Read() - start;
+}
+
+static uint64_t Bench_InPlace(uint32_t batch)
+{
+	// Filled in place, then read one item at a time from its slot.
+	uint64_t start = Cycles_Read();
+	for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+	{
+		Bench_Fill(batch);
+		const Bench_Item_t * item;
+		while ((item = Queue_Peek(&gQueue)) != NULL)
+		{
+			gSink += item->lateness;
+			Queue_Release(&gQueue, 1);
+		}
+	}
+	return Cycles_Read() - start;
+}
+
+static uint64_t Bench_Span(uint32_t batch)
+{
+	// Filled in place, then drained a run at a time, as the late reports are.
+	uint64_t start = Cycles_Read();
+	for (uint32_t r = 0; r < BENCH_ROUNDS; r++)
+	{
+		Bench_Fill(batch);
+		Bench_Item_t * items;
+		uint32_t count;
+		while ((count = Queue_PeekSpan(&gQueue, (void **)&items)) > 0)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				gSink += items[i].lateness;
+			}
+			Queue_Release(&gQueue, count);
+		}
+	}
+	return Cycles_Read() - start;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Queue_Init(&gQueue, gBuffer, sizeof(*gBuffer), LENGTH(gBuffer));
+
+	printf("batch  push/pop  pushn/popn  reserve/peek  reserve/span  (%s per item)\n", CYCLES_UNIT);
+	for (uint32_t batch = 1; batch <= BENCH_SIZE; batch *= 2)
+	{
+		double items = (double)BENCH_ROUNDS * batch;
+		printf("%5u  %8.1f  %10.1f  %12.1f  %12.1f\n", batch,
+				Bench_PushPop(batch) / items,
+				Bench_Bulk(batch) / items,
+				Bench_InPlace(batch) / items,
+				Bench_Span(batch) / items);
+	}
+	return 0;
+}
@@ -0,0 +1,189 @@
+// Host stress test of Queue as a lock free single producer, single consumer
+// ring. A producer and a consumer thread run flat out against a small queue,
+// so the indices wrap often and both sides are usually racing on the same slot.
+// Build from the repo root with:
+//   gcc -O2 -pthread -ITests/host -ICore Tests/queue_stress.c Core/Queue.c -o queue_stress
+
+#include "STM32X.h"
+#include "Queue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+/*
+ * PRIVATE DEFINITIONS
+ */
+
+#define STRESS_SIZE			8
+#define STRESS_ITEMS		2000000
+#define STRESS_BATCH		5 // Batches of one up to this, so they start all around the ring
+
+/*
+ * PRIVATE TYPES
+ */
+
+// Larger than a word, so a torn copy shows up as a mismatch.
+typedef struct {
+	uint32_t seq;
+	uint32_t check;
+	uint32_t pad[2];
+} Stress_Item_t;
+
+/*
+ * PRIVATE VARIABLES
+ */
+
+static Stress_Item_t gBuffer[STRESS_SIZE];
+static Queue_t gQueue;
+
+/*
+ * PRIVATE FUNCTIONS
+ */
+
+static Stress_Item_t Stress_Make(uint32_t seq)
+{
+	return (Stress_Item_t){ .seq = seq, .check = ~seq, .pad = { seq * 3, seq * 7 } };
+}
+
+static bool Stress_Check(const Stress_Item_t * item, uint32_t seq)
+{
+	return item->seq == seq && item->check == ~seq
+		&& item->pad[0] == seq * 3 && item->pad[1] == seq * 7;
+}
+
+static void * Stress_Produce(void * arg)
+{
+	// Rotates between copying in, filling in place, and copying in a batch.
+	// A full queue yields.
+	uint32_t seq = 0;
+	for (uint32_t turn = 0; seq < STRESS_ITEMS; )
+	{
+		switch (turn % 3)
+		{
+		case 0:
+		{
+			Stress_Item_t item = Stress_Make(seq);
+			if (!Queue_Push(&gQueue, &item)) { sched_yield(); continue; }
+			seq += 1;
+			break;
+		}
+		case 1:
+		{
+			Stress_Item_t * slot = Queue_Reserve(&gQueue);
+			if (slot == NULL) { sched_yield(); continue; }
+			*slot = Stress_Make(seq);
+			Queue_Commit(&gQueue);
+			seq += 1;
+			break;
+		}
+		default:
+		{
+			// Only part of the batch may fit. The rest is made again next time.
+			Stress_Item_t items[STRESS_BATCH];
+			uint32_t count = MIN(1 + (seq % STRESS_BATCH), STRESS_ITEMS - seq);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				items[i] = Stress_Make(seq + i);
+			}
+			count = Queue_PushN(&gQueue, items, count);
+			if (count == 0) { sched_yield(); continue; }
+			seq += count;
+
+			// Hands over part way through, so a single core does not always
+			// fill the queue up and drain it empty in the same pattern.
+			if (seq % 7 == 0) { sched_yield(); }
+			break;
+		}
+		}
+		turn += 1;
+	}
+	return NULL;
+}
+
+static void * Stress_Consume(void * arg)
+{
+	// Rotates between a copy out, a read in place, a run at a time, and a batch copy out.
+	// An empty queue yields, so this also runs on a single core.
+	uint32_t seq = 0;
+	uint32_t * errors = arg;
+	for (uint32_t turn = 0; seq < STRESS_ITEMS; )
+	{
+		if (Queue_Count(&gQueue) == 0)
+		{
+			sched_yield();
+			continue;
+		}
+
+		switch (turn % 4)
+		{
+		case 0:
+		{
+			Stress_Item_t item;
+			if (Queue_Pop(&gQueue, &item))
+			{
+				if (!Stress_Check(&item, seq)) { *errors += 1; }
+				seq += 1;
+			}
+			break;
+		}
+		case 1:
+		{
+			const Stress_Item_t * item = Queue_Peek(&gQueue);
+			if (item != NULL)
+			{
+				if (!Stress_Check(item, seq)) { *errors += 1; }
+				Queue_Release(&gQueue, 1);
+				seq += 1;
+			}
+			break;
+		}
+		case 2:
+		{
+			Stress_Item_t * items;
+			uint32_t count = Queue_PeekSpan(&gQueue, (void **)&items);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (!Stress_Check(&items[i], seq + i)) { *errors += 1; }
+			}
+			Queue_Release(&gQueue, count);
+			seq += count;
+			break;
+		}
+		default:
+		{
+			Stress_Item_t items[STRESS_BATCH];
+			uint32_t count = Queue_PopN(&gQueue, items, 1 + (turn % STRESS_BATCH));
+			for (uint32_t i = 0; i < count; i++)
+			{
+				if (!Stress_Check(&items[i], seq + i)) { *errors += 1; }
+			}
+			seq += count;
+			break;
+		}
+		}
+		turn += 1;
+	}
+	return NULL;
+}
+
+/*
+ * PUBLIC FUNCTIONS
+ */
+
+int main(void)
+{
+	Queue_Init(&gQueue, gBuffer, sizeof(*gBuffer), LENGTH(gBuffer));
+
+	uint32_t errors = 0;
+	pthread_t producer;
+	pthread_t consumer;
+	pthread_create(&consumer, NULL, Stress_Consume, &errors);
+	pthread_create(&producer, NULL, Stress_Produce, NULL);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+
+	bool empty = Queue_Count(&gQueue) == 0;
+	printf("%u items through a queue of %u, %u errors%s\n",
+			STRESS_ITEMS, STRESS_SIZE, errors, empty ? "" : ", not empty at the end");
+	return (errors == 0 && empty) ? 0 : 1;
+}
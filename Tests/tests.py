@@ -41,6 +41,12 @@ class TxBusThread(threading.Thread):
         self.tx_block = 64
 
     def run(self):
+        if self.tx_rate is None:
+            # Flow controlled: send() paces itself against the device credit.
+            while self.running:
+                self.send_next()
+            return
+
         t = time.time()
         while self.running:
             now = time.time()
@@ -152,6 +158,35 @@ def test_transmission(busa: canmaster.CANMaster, busb: canmaster.CANMaster, conf
     }
     return stats
 
+def test_saturation(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
+
+    # only enable terminator on one side - in case the other has failed.
+    busa.configure(config['bitrate'], terminator=True, error_code=True)
+    busb.configure(config['bitrate'], terminator=False, error_code=True)
+    busa.configure_stream(flow_control=True)
+
+    tx_thread = TxBusThread(busa, None)
+    rx_thread = RxBusThread(busb)
+
+    tx_thread.start()
+    rx_thread.start()
+
+    time.sleep(config['test_time'])
+
+    tx_thread.stop()
+    tx_thread.join()
+    time.sleep(0.1)
+    rx_thread.stop()
+    busa.configure_stream()
+
+    stats = {
+        "recieved": rx_thread.recieved,
+        "sent": tx_thread.sent,
+        "errors": rx_thread.errors,
+        "rate": rx_thread.recieved / config['test_time']
+    }
+    return stats
+
 def test_pingpong_transmission(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
     
         # only enable terminator on one side - in case the other has failed.
@@ -175,6 +210,201 @@ def test_pingpong_transmission(busa: canmaster.CANMaster, busb: canmaster.CANMas
         return stats
 
 
+def test_filters(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
+
+    busa.configure(config['bitrate'], terminator=True, error_code=True)
+    busb.configure(config['bitrate'], terminator=False, error_code=True)
+
+    # Bank 0 holds filters 0 to 3, bank 1 holds 4 and 5, and bank 2 holds 6.
+    other_id = 0x123
+    busb.set_filters([
+        canmaster.filter_list16([0x100, 0x101, 0x102, 0x103]),
+        canmaster.filter_list32(0x7FF, other_id, fifo=1),
+        canmaster.filter_mask32(TEST_ID, 0x1FFFFFFF, ext=True),
+    ])
+    busb.configure_stream(filter_index=True)
+    time.sleep(0.1)
+
+    sent = 0
+    for counter in range(100):
+        busa.send(test_message(counter))
+        busa.send(can.Message(arbitration_id=0x200, data=[counter & 0xFF], is_extended_id=False))
+        busa.send(can.Message(arbitration_id=other_id, data=[counter & 0xFF], is_extended_id=False))
+        sent += 1
+        time.sleep(0.002)
+
+    recieved = 0
+    errors = 0
+    while (msg := busb.recv(0.2)) is not None:
+        recieved += 1
+        expected = 6 if msg.arbitration_id == TEST_ID else 5
+        if msg.arbitration_id not in (TEST_ID, other_id) or msg.channel != expected:
+            print("Error: ID 0x%x matched filter %s" % (msg.arbitration_id, msg.channel))
+            errors += 1
+
+    busb.configure_stream()
+    busb.set_filters([])
+
+    # Only the test and other IDs pass, and each is counted as sent.
+    stats = {
+        "recieved": recieved,
+        "sent": sent * 2,
+        "errors": errors,
+        "rate": recieved / config['test_time']
+    }
+    return stats
+
+
+def test_rate_limit(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
+
+    busa.configure(config['bitrate'], terminator=True, error_code=True)
+    busb.configure(config['bitrate'], terminator=False, error_code=True)
+
+    # Every 4th test message passes, and other IDs are untouched.
+    other_id = 0x321
+    busb.set_rate_limit(TEST_ID, ext=TEST_EXT, every=4, clear=True)
+    time.sleep(0.1)
+
+    sent = 0
+    for counter in range(100):
+        busa.send(test_message(counter))
+        busa.send(can.Message(arbitration_id=other_id, data=[counter & 0xFF], is_extended_id=False))
+        sent += 1
+        time.sleep(0.002)
+
+    recieved = 0
+    errors = 0
+    others = 0
+    while (msg := busb.recv(0.2)) is not None:
+        if msg.arbitration_id == other_id:
+            others += 1
+            continue
+        if get_counter(msg) != recieved * 4:
+            print("Error: Expected counter %d, got %d" % (recieved * 4, get_counter(msg)))
+            errors += 1
+        recieved += 1
+
+    table = busb.read_rate_limits()
+    if table is None or len(table) != 1 or table[0]["dropped"] != sent - sent // 4:
+        print("Error: Rate limit table reads back as %s" % table)
+        errors += 1
+    if others != sent:
+        print("Error: %d of %d unlimited messages recieved" % (others, sent))
+        errors += 1
+
+    busb.clear_rate_limits()
+
+    stats = {
+        "recieved": recieved,
+        "sent": sent // 4,
+        "errors": errors,
+        "rate": recieved / config['test_time']
+    }
+    return stats
+
+
+def test_capture(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
+
+    busa.configure(config['bitrate'], terminator=True, error_code=True)
+    busb.configure(config['bitrate'], terminator=False, error_code=True)
+
+    # Trigger on the low byte of the counter, and hold the stream while recording.
+    pre = 10
+    post = 5
+    trigger = 50
+    busb.arm_capture(canmaster.CAPTURE_FRAME, pre, post, arbitration_id=TEST_ID, id_mask=0x1FFFFFFF, is_extended_id=TEST_EXT,
+                     data=bytes(7) + bytes([trigger]), data_mask=bytes(7) + b"\xFF", quiet=True)
+    time.sleep(0.1)
+
+    sent = 0
+    for counter in range(100):
+        busa.send(test_message(counter))
+        sent += 1
+        time.sleep(0.002)
+
+    errors = 0
+    snapshot = busb.read_capture()
+    recieved = 0
+    if snapshot is None:
+        print("Error: No capture snapshot")
+        errors += 1
+    else:
+        frames, before = snapshot
+        recieved = len(frames)
+        counters = [get_counter(msg) for msg in frames]
+        if before != pre or counters != list(range(trigger - pre, trigger + post + 1)):
+            print("Error: Captured %s, with %d before the trigger" % (counters, before))
+            errors += 1
+
+    # Only frames after the capture finished are streamed.
+    streamed = 0
+    while (msg := busb.recv(0.2)) is not None:
+        if get_counter(msg) <= trigger + post:
+            print("Error: Counter %d streamed while capturing" % get_counter(msg))
+            errors += 1
+        streamed += 1
+    if streamed != sent - (trigger + post + 1):
+        print("Error: %d messages streamed after the capture" % streamed)
+        errors += 1
+
+    stats = {
+        "recieved": recieved,
+        "sent": pre + post + 1,
+        "errors": errors,
+        "rate": recieved / config['test_time']
+    }
+    return stats
+
+
+def test_configure(busa: canmaster.CANMaster, busb: canmaster.CANMaster, config: dict = {}) -> dict:
+
+    # Each configure waits on the acknowledgement, which must echo the settings. The standard
+    # bitrates divide the clock exactly. Only a change of bitrate or mode restarts the controller.
+    errors = 0
+    sent = 0
+    recieved = 0
+    sequence = None
+    steps = [
+        (125000, False, True),
+        (125000, True, False),
+        (500000, True, True),
+        (1000000, True, True),
+        (config['bitrate'], True, True),
+    ]
+    for bitrate, terminator, restart in steps:
+        sent += 1
+        try:
+            busa.configure(bitrate, terminator=terminator, error_code=True)
+        except TimeoutError:
+            print("Error: No acknowledgement at %d bit/s" % bitrate)
+            errors += 1
+            continue
+        ack = busa.config_ack
+        recieved += 1
+        if ack["bitrate"] != bitrate or ack["actual_bitrate"] != bitrate or ack["terminator"] != terminator or not ack["error_code"]:
+            print("Error: Acknowledged %s" % ack)
+            errors += 1
+        if not 0.5 <= ack["sample_point"] <= 0.95:
+            print("Error: Sample point of %.1f%% at %d bit/s" % (ack["sample_point"] * 100, bitrate))
+            errors += 1
+        # The first step may or may not change the bitrate, depending on what ran before.
+        if sent > 1 and ack["restarted"] != restart:
+            print("Error: Restart was %s at %d bit/s" % (ack["restarted"], bitrate))
+            errors += 1
+        if sequence is not None and ack["sequence"] != (sequence + 1) & 0xFFFF:
+            print("Error: Sequence %d followed %d" % (ack["sequence"], sequence))
+            errors += 1
+        sequence = ack["sequence"]
+
+    busb.configure(config['bitrate'], terminator=False, error_code=True)
+    return {
+        "recieved": recieved,
+        "sent": sent,
+        "errors": errors,
+        "rate": recieved / config['test_time']
+    }
+
+
 def print_stats(stats: dict):
     print("Recieved: %d" % stats["recieved"])
     print("Sent: %d" % stats["sent"])
@@ -239,8 +469,28 @@ def main():
     print("Testing ping pong")
     pp = test_pingpong_transmission(busa, busb, config)
     print_stats(pp)
-
-    if check_stats(config, atob) and check_stats(config, btoa):
+    print("Testing flow controlled saturation bus A -> bus B")
+    sat = test_saturation(busa, busb, config)
+    print_stats(sat)
+    print("Testing filter banks bus A -> bus B")
+    filt = test_filters(busa, busb, config)
+    print_stats(filt)
+    print("Testing rate limits bus A -> bus B")
+    rate = test_rate_limit(busa, busb, config)
+    print_stats(rate)
+    print("Testing trigger capture bus A -> bus B")
+    cap = test_capture(busa, busb, config)
+    print_stats(cap)
+    print("Testing configuration acknowledgement bus A")
+    conf = test_configure(busa, busb, config)
+    print_stats(conf)
+
+    # A saturated bus must beat the paced rate, with nothing dropped.
+    filters_ok = filt["errors"] == 0 and filt["sent"] == filt["recieved"]
+    filters_ok = filters_ok and rate["errors"] == 0 and rate["sent"] == rate["recieved"]
+    filters_ok = filters_ok and cap["errors"] == 0 and cap["sent"] == cap["recieved"]
+    filters_ok = filters_ok and conf["errors"] == 0 and conf["sent"] == conf["recieved"]
+    if check_stats(config, atob) and check_stats(config, btoa) and check_stats(config, sat) and filters_ok:
         print("Test passed")
     else:
         print("Test failed")